@@ -0,0 +1,707 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TTFTK_IMPLEMENTATION
+#include "ttftk.h"
+
+// ttftk_bench [--repetitions N] [--warmup N] [--filter substring] [--json path]
+//             [--ppem a,b,...] [--sampling a,b,...] font.ttf...
+//
+// Every benchmark sweeps all glyphs of a font once per repetition. Reported
+// times are per operation (one glyph, one lookup or one sample evaluation),
+// percentiles are taken over repetitions.
+
+struct BenchConfig
+{
+    uint32_t repetitions = 20;
+    uint32_t warmup = 3;
+    std::string filter{};
+    std::string jsonPath{};
+    std::vector<uint32_t> ppems{ 12, 32, 96 };
+    std::vector<uint32_t> samplingRates{ 0, 2 };
+    std::vector<std::string> fonts{};
+};
+
+struct BenchResult
+{
+    std::string name;
+    std::string font;
+    uint64_t opsPerRepetition;
+    std::vector<double> nsPerOp;
+    double min, mean, p50, p90, p99;
+};
+
+static volatile uint64_t gSink = 0u;
+
+static inline void Consume(uint64_t _value)
+{
+    gSink = gSink + _value;
+}
+
+std::vector<uint8_t> LoadFile(char const* _path)
+{
+    std::ifstream source_file(_path, std::ios_base::binary);
+
+    source_file.seekg(0, std::ios_base::end);
+    size_t size = source_file.tellg();
+    source_file.seekg(0, std::ios_base::beg);
+
+    std::vector<uint8_t> memory{};
+    memory.resize(size);
+
+    source_file.read((char*)memory.data(), size);
+
+    return memory;
+}
+
+std::vector<uint32_t> ParseList(char const* _arg)
+{
+    std::vector<uint32_t> output{};
+    char const* ptr = _arg;
+    while (*ptr)
+    {
+        char* end = nullptr;
+        output.push_back((uint32_t)std::strtol(ptr, &end, 10));
+        ptr = (*end == ',') ? end + 1 : end;
+    }
+    return output;
+}
+
+double Percentile(std::vector<double> const& _sorted, double _p)
+{
+    double const rank = _p * (double)(_sorted.size() - 1);
+    size_t const lo = (size_t)std::floor(rank);
+    size_t const hi = std::min(lo + 1, _sorted.size() - 1);
+    return _sorted[lo] + (_sorted[hi] - _sorted[lo]) * (rank - (double)lo);
+}
+
+bool RunBench(BenchConfig const& _config, std::string const& _font, std::string const& _name,
+              uint64_t _ops, std::function<void()> const& _body, std::vector<BenchResult>& _results)
+{
+    if (!_config.filter.empty() && _name.find(_config.filter) == std::string::npos)
+        return false;
+    if (_ops == 0u)
+        return false;
+
+    for (uint32_t index = 0u; index < _config.warmup; ++index)
+        _body();
+
+    BenchResult result{};
+    result.name = _name;
+    result.font = _font;
+    result.opsPerRepetition = _ops;
+    for (uint32_t index = 0u; index < _config.repetitions; ++index)
+    {
+        auto const begin = std::chrono::steady_clock::now();
+        _body();
+        auto const end = std::chrono::steady_clock::now();
+        double const ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+        result.nsPerOp.push_back(ns / (double)_ops);
+    }
+
+    std::vector<double> sorted(result.nsPerOp);
+    std::sort(sorted.begin(), sorted.end());
+    result.min = sorted.front();
+    result.mean = 0.0;
+    for (double v : sorted)
+        result.mean += v / (double)sorted.size();
+    result.p50 = Percentile(sorted, 0.5);
+    result.p90 = Percentile(sorted, 0.9);
+    result.p99 = Percentile(sorted, 0.99);
+
+    std::printf("%-40s %-28s %12.1f ns/op %14.0f op/s  p50 %10.1f  p90 %10.1f  p99 %10.1f\n",
+                result.name.c_str(), result.font.c_str(), result.mean, 1e9 / result.mean,
+                result.p50, result.p90, result.p99);
+    std::fflush(stdout);
+
+    _results.push_back(std::move(result));
+    return true;
+}
+
+void WriteJSON(BenchConfig const& _config, std::vector<BenchResult> const& _results)
+{
+    std::ofstream out(_config.jsonPath);
+    out << "{\n  \"repetitions\": " << _config.repetitions
+        << ",\n  \"warmup\": " << _config.warmup
+        << ",\n  \"benchmarks\": [\n";
+    for (size_t index = 0u; index < _results.size(); ++index)
+    {
+        BenchResult const& result = _results[index];
+        out << "    { \"name\": \"" << result.name << "\""
+            << ", \"font\": \"" << result.font << "\""
+            << ", \"ops\": " << result.opsPerRepetition
+            << ", \"ns_per_op\": " << result.mean
+            << ", \"ops_per_second\": " << 1e9 / result.mean
+            << ", \"min\": " << result.min
+            << ", \"p50\": " << result.p50
+            << ", \"p90\": " << result.p90
+            << ", \"p99\": " << result.p99
+            << ", \"samples\": [";
+        for (size_t sample = 0u; sample < result.nsPerOp.size(); ++sample)
+            out << (sample ? ", " : "") << result.nsPerOp[sample];
+        out << "] }" << ((index + 1 < _results.size()) ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+void BenchFont(BenchConfig const& _config, std::string const& _path, std::vector<BenchResult>& _results)
+{
+    std::vector<uint8_t> memory = LoadFile(_path.c_str());
+    std::string const font = _path.substr(_path.find_last_of("/\\") + 1);
+
+    ttftk::TrueTypeFile ttfFile{};
+    if (ttftk::LoadTTF(memory.data(), &ttfFile) != ttftk::Result::Success)
+    {
+        std::cout << "error parsing " << _path << std::endl;
+        return;
+    }
+
+    static constexpr uint32_t kLoadCount = 256u;
+    RunBench(_config, font, "LoadTTF", kLoadCount, [&]()
+    {
+        for (uint32_t index = 0u; index < kLoadCount; ++index)
+        {
+            ttftk::TrueTypeFile file{};
+            ttftk::LoadTTF(memory.data(), &file);
+            Consume(file.glyphCount);
+        }
+    }, _results);
+
+    std::vector<uint32_t> charCodes = ttftk::ListCharCodes(ttfFile);
+    RunBench(_config, font, "GetGlyphIndex", charCodes.size(), [&]()
+    {
+        for (uint32_t charCode : charCodes)
+            Consume(ttftk::GetGlyphIndex(ttfFile, charCode));
+    }, _results);
+
+    // Single font chain, the lookups run against the chain table instead of the cmap.
+    ttftk::FontRegistry registry{};
+    uint32_t const registryFont = ttftk::RegisterFont(&registry, ttfFile);
+    uint32_t const chain = ttftk::CreateFallbackChain(&registry, &registryFont, 1u);
+    RunBench(_config, font, "FindCoveringFont", charCodes.size(), [&]()
+    {
+        uint32_t glyphIndex = 0u;
+        for (uint32_t charCode : charCodes)
+            Consume(ttftk::FindCoveringFont(registry, chain, charCode, &glyphIndex) + glyphIndex);
+    }, _results);
+
+    std::vector<ttftk::FontRun> fontRuns{};
+    std::vector<uint32_t> runGlyphs{};
+    RunBench(_config, font, "ResolveFontRuns", charCodes.size(), [&]()
+    {
+        ttftk::ResolveFontRuns(registry, chain, charCodes.data(), charCodes.size(), &fontRuns, &runGlyphs);
+        Consume(fontRuns.size());
+    }, _results);
+
+    ttftk::Glyph glyph{};
+    RunBench(_config, font, "ReadGlyphData", charCodes.size(), [&]()
+    {
+        for (uint32_t charCode : charCodes)
+        {
+            ttftk::ReadGlyphData(ttfFile, charCode, &glyph);
+            Consume(glyph.contours.size());
+        }
+    }, _results);
+
+    std::vector<ttftk::CharGlyphPair> const fileOrder = ttftk::ListGlyphsInFileOrder(ttfFile);
+    RunBench(_config, font, "ListGlyphsInFileOrder", charCodes.size(), [&]()
+    {
+        Consume(ttftk::ListGlyphsInFileOrder(ttfFile).size());
+    }, _results);
+
+    RunBench(_config, font, "ReadGlyphIndexData/fileorder", fileOrder.size(), [&]()
+    {
+        for (ttftk::CharGlyphPair const& entry : fileOrder)
+        {
+            ttftk::ReadGlyphIndexData(ttfFile, entry.glyphIndex, &glyph);
+            Consume(glyph.contours.size());
+        }
+    }, _results);
+
+    std::vector<uint8_t> compiledBlob{};
+    ttftk::CompileFont(ttfFile, &compiledBlob);
+    RunBench(_config, font, "OpenCompiledFont", kLoadCount, [&]()
+    {
+        for (uint32_t index = 0u; index < kLoadCount; ++index)
+        {
+            ttftk::CompiledFont compiled{};
+            ttftk::OpenCompiledFont(compiledBlob.data(), compiledBlob.size(), &compiled);
+            Consume(compiled.header->glyphCount);
+        }
+    }, _results);
+
+    ttftk::CompiledFont compiledFont{};
+    ttftk::OpenCompiledFont(compiledBlob.data(), compiledBlob.size(), &compiledFont);
+    RunBench(_config, font, "ReadGlyphIndexData/compiled", ttfFile.glyphCount, [&]()
+    {
+        for (uint32_t glyphIndex = 0u; glyphIndex < ttfFile.glyphCount; ++glyphIndex)
+        {
+            ttftk::ReadGlyphIndexData(compiledFont, glyphIndex, &glyph);
+            Consume(glyph.contours.size());
+        }
+    }, _results);
+
+    // Printable ASCII, the typical subset shipped for a Latin UI.
+    std::vector<uint32_t> asciiCodes{};
+    for (uint32_t charCode = 0x20u; charCode < 0x7Fu; ++charCode)
+        asciiCodes.push_back(charCode);
+    std::vector<uint8_t> subset{};
+    RunBench(_config, font, "SubsetFont/ascii", asciiCodes.size(), [&]()
+    {
+        ttftk::SubsetFont(ttfFile, asciiCodes.data(), asciiCodes.size(), &subset);
+        Consume(subset.size());
+    }, _results);
+
+    // Every glyph of the font, decoded once for the evaluation benchmarks.
+    std::vector<ttftk::Glyph> glyphs{};
+    glyphs.reserve(ttfFile.glyphCount);
+    for (uint32_t glyphIndex = 0u; glyphIndex < ttfFile.glyphCount; ++glyphIndex)
+    {
+        ttftk::Glyph decoded{};
+        if (ttftk::ReadGlyphIndexData(ttfFile, glyphIndex, &decoded) == ttftk::Result::Success
+            && !decoded.contours.empty())
+            glyphs.push_back(std::move(decoded));
+    }
+
+    RunBench(_config, font, "ReadGlyphIndexData", ttfFile.glyphCount, [&]()
+    {
+        for (uint32_t glyphIndex = 0u; glyphIndex < ttfFile.glyphCount; ++glyphIndex)
+        {
+            ttftk::ReadGlyphIndexData(ttfFile, glyphIndex, &glyph);
+            Consume(glyph.contours.size());
+        }
+    }, _results);
+
+    // Sample grid spanning each glyph's bounding box.
+    static constexpr int kSampleGrid = 16;
+    auto const sweepSamples = [&](auto&& _eval)
+    {
+        for (ttftk::Glyph const& g : glyphs)
+        {
+            for (int y = 0; y < kSampleGrid; ++y)
+            {
+                for (int x = 0; x < kSampleGrid; ++x)
+                {
+                    int16_t const sampleX = (int16_t)(g.xmin + ((g.xmax - g.xmin) * (2*x + 1)) / (2*kSampleGrid));
+                    int16_t const sampleY = (int16_t)(g.ymin + ((g.ymax - g.ymin) * (2*y + 1)) / (2*kSampleGrid));
+                    _eval(g, sampleX, sampleY);
+                }
+            }
+        }
+    };
+    uint64_t const sampleOps = glyphs.size() * kSampleGrid * kSampleGrid;
+
+    RunBench(_config, font, "EvalWindingNumber", sampleOps, [&]()
+    {
+        sweepSamples([](ttftk::Glyph const& _g, int16_t _x, int16_t _y)
+        {
+            Consume((uint64_t)ttftk::EvalWindingNumber(&_g, _x, _y, nullptr));
+        });
+    }, _results);
+
+    RunBench(_config, font, "EvalWindingNumber+distance", sampleOps, [&]()
+    {
+        sweepSamples([](ttftk::Glyph const& _g, int16_t _x, int16_t _y)
+        {
+            float distance = 0.f;
+            Consume((uint64_t)ttftk::EvalWindingNumber(&_g, _x, _y, &distance));
+        });
+    }, _results);
+
+    // Same samples against the outlines transformed once to float, at font unit scale.
+    std::vector<ttftk::GlyphOutline> outlines(glyphs.size());
+    for (size_t index = 0u; index < glyphs.size(); ++index)
+        ttftk::TransformGlyph(&glyphs[index], 1.f, 1.f, 0.f, 0.f, &outlines[index]);
+
+    auto const sweepOutlineSamples = [&](auto&& _eval)
+    {
+        for (ttftk::GlyphOutline const& o : outlines)
+        {
+            for (int y = 0; y < kSampleGrid; ++y)
+            {
+                for (int x = 0; x < kSampleGrid; ++x)
+                {
+                    float const sampleX = o.xmin + ((o.xmax - o.xmin) * (float)(2*x + 1)) / (float)(2*kSampleGrid);
+                    float const sampleY = o.ymin + ((o.ymax - o.ymin) * (float)(2*y + 1)) / (float)(2*kSampleGrid);
+                    _eval(o, sampleX, sampleY);
+                }
+            }
+        }
+    };
+
+    RunBench(_config, font, "EvalWindingNumber/outline", sampleOps, [&]()
+    {
+        sweepOutlineSamples([](ttftk::GlyphOutline const& _o, float _x, float _y)
+        {
+            Consume((uint64_t)ttftk::EvalWindingNumber(&_o, _x, _y, nullptr));
+        });
+    }, _results);
+
+    RunBench(_config, font, "EvalWindingNumber+distance/outline", sampleOps, [&]()
+    {
+        sweepOutlineSamples([](ttftk::GlyphOutline const& _o, float _x, float _y)
+        {
+            float distance = 0.f;
+            Consume((uint64_t)ttftk::EvalWindingNumber(&_o, _x, _y, &distance));
+        });
+    }, _results);
+
+    RunBench(_config, font, "EvalDistance", sampleOps, [&]()
+    {
+        sweepSamples([](ttftk::Glyph const& _g, int16_t _x, int16_t _y)
+        {
+            Consume((uint64_t)ttftk::EvalDistance(&_g, _x, _y));
+        });
+    }, _results);
+
+    // The same sample grids classified one glyph per call.
+    std::vector<std::vector<ttftk::GlyphPoint>> glyphSamples(glyphs.size());
+    for (size_t index = 0u; index < glyphs.size(); ++index)
+    {
+        ttftk::Glyph const& g = glyphs[index];
+        for (int y = 0; y < kSampleGrid; ++y)
+        {
+            for (int x = 0; x < kSampleGrid; ++x)
+            {
+                glyphSamples[index].push_back(ttftk::GlyphPoint{
+                    (int16_t)(g.xmin + ((g.xmax - g.xmin) * (2*x + 1)) / (2*kSampleGrid)),
+                    (int16_t)(g.ymin + ((g.ymax - g.ymin) * (2*y + 1)) / (2*kSampleGrid)) });
+            }
+        }
+    }
+    std::vector<uint8_t> inside(kSampleGrid * kSampleGrid);
+    std::vector<float> distances(kSampleGrid * kSampleGrid);
+    RunBench(_config, font, "ClassifyPoints", sampleOps, [&]()
+    {
+        for (size_t index = 0u; index < glyphs.size(); ++index)
+        {
+            ttftk::ClassifyPoints(&glyphs[index], glyphSamples[index].data(), glyphSamples[index].size(),
+                                  inside.data());
+            Consume(inside[0]);
+        }
+    }, _results);
+    RunBench(_config, font, "ClassifyPoints+distance", sampleOps, [&]()
+    {
+        for (size_t index = 0u; index < glyphs.size(); ++index)
+        {
+            float const maxDistance = (float)ttfFile.emsize / 16.f;
+            ttftk::ClassifyPoints(&glyphs[index], glyphSamples[index].data(), glyphSamples[index].size(),
+                                  inside.data(), distances.data(), maxDistance);
+            Consume(inside[0]);
+        }
+    }, _results);
+
+    ttftk::GlyphMesh mesh{};
+    RunBench(_config, font, "BuildGlyphMesh", glyphs.size(), [&]()
+    {
+        for (ttftk::Glyph const& g : glyphs)
+        {
+            ttftk::BuildGlyphMesh(&g, &mesh);
+            Consume(mesh.indices.size());
+        }
+    }, _results);
+
+    ttftk::CoverageBitmap bitmap{};
+    for (uint32_t ppem : _config.ppems)
+    {
+        float const pixelSize = (float)ttfFile.emsize / (float)ppem;
+        for (uint32_t samplingRate : _config.samplingRates)
+        {
+            for (int subPixelEval = 0; subPixelEval < 2; ++subPixelEval)
+            {
+                std::string const name = "RenderGlyph/ppem=" + std::to_string(ppem)
+                    + "/rate=" + std::to_string(samplingRate)
+                    + "/subpixel=" + std::to_string(subPixelEval);
+                RunBench(_config, font, name, glyphs.size(), [&]()
+                {
+                    for (ttftk::Glyph const& g : glyphs)
+                    {
+                        ttftk::RasterizeGlyph(&g, pixelSize, samplingRate, !!subPixelEval, &bitmap);
+                        Consume(bitmap.pixels.size());
+                    }
+                }, _results);
+            }
+        }
+    }
+
+    // Outline levels at 1/256 em, each configured ppem renders the coarsest level within 1/8 pixel.
+    float const levelTolerance = (float)ttfFile.emsize / 256.f;
+    std::vector<ttftk::GlyphLevels> glyphLevels(glyphs.size());
+    for (size_t index = 0u; index < glyphs.size(); ++index)
+        ttftk::BuildGlyphLevels(&glyphs[index], levelTolerance, 5u, &glyphLevels[index]);
+    ttftk::GlyphLevels levels{};
+    RunBench(_config, font, "BuildGlyphLevels", glyphs.size(), [&]()
+    {
+        for (ttftk::Glyph const& g : glyphs)
+        {
+            ttftk::BuildGlyphLevels(&g, levelTolerance, 5u, &levels);
+            Consume(levels.levels.size());
+        }
+    }, _results);
+    for (uint32_t ppem : _config.ppems)
+    {
+        float const pixelSize = (float)ttfFile.emsize / (float)ppem;
+        for (uint32_t samplingRate : _config.samplingRates)
+        {
+            std::string const name = "RenderGlyph/lod/ppem=" + std::to_string(ppem)
+                + "/rate=" + std::to_string(samplingRate);
+            RunBench(_config, font, name, glyphs.size(), [&]()
+            {
+                for (ttftk::GlyphLevels const& glyphLevel : glyphLevels)
+                {
+                    ttftk::RasterizeGlyph(ttftk::SelectGlyphLevel(glyphLevel, pixelSize), pixelSize, samplingRate,
+                                          false, &bitmap);
+                    Consume(bitmap.pixels.size());
+                }
+            }, _results);
+        }
+    }
+
+    // Every configured ppem per glyph, decoded and set up once per size against once for all sizes.
+    std::vector<float> pixelSizes{};
+    for (uint32_t ppem : _config.ppems)
+        pixelSizes.push_back((float)ttfFile.emsize / (float)ppem);
+    std::vector<ttftk::CoverageBitmap> sizeBitmaps(pixelSizes.size());
+    std::vector<ttftk::CoverageBitmap> mips(3);
+    for (uint32_t samplingRate : _config.samplingRates)
+    {
+        std::string const suffix = "/sizes=" + std::to_string(pixelSizes.size())
+            + "/rate=" + std::to_string(samplingRate);
+        RunBench(_config, font, "RenderSizes/independent" + suffix, ttfFile.glyphCount, [&]()
+        {
+            for (uint32_t glyphIndex = 0u; glyphIndex < ttfFile.glyphCount; ++glyphIndex)
+            {
+                for (size_t size = 0u; size < pixelSizes.size(); ++size)
+                {
+                    ttftk::ReadGlyphIndexData(ttfFile, glyphIndex, &glyph);
+                    ttftk::RasterizeGlyph(&glyph, pixelSizes[size], samplingRate, false, &sizeBitmaps[size]);
+                    Consume(sizeBitmaps[size].pixels.size());
+                }
+            }
+        }, _results);
+        RunBench(_config, font, "RenderSizes/shared" + suffix, ttfFile.glyphCount, [&]()
+        {
+            for (uint32_t glyphIndex = 0u; glyphIndex < ttfFile.glyphCount; ++glyphIndex)
+            {
+                ttftk::ReadGlyphIndexData(ttfFile, glyphIndex, &glyph);
+                ttftk::RasterizeGlyphSizes(&glyph, pixelSizes.data(), pixelSizes.size(), samplingRate, false,
+                                           sizeBitmaps.data());
+                Consume(sizeBitmaps[0].pixels.size());
+            }
+        }, _results);
+        RunBench(_config, font, "RenderSizes/shared+mips" + suffix, ttfFile.glyphCount, [&]()
+        {
+            for (uint32_t glyphIndex = 0u; glyphIndex < ttfFile.glyphCount; ++glyphIndex)
+            {
+                ttftk::ReadGlyphIndexData(ttfFile, glyphIndex, &glyph);
+                ttftk::RasterizeGlyphSizes(&glyph, pixelSizes.data(), pixelSizes.size(), samplingRate, false,
+                                           sizeBitmaps.data(), (uint32_t)mips.size(), mips.data());
+                Consume(mips.back().pixels.size());
+            }
+        }, _results);
+    }
+
+    // Dynamic atlas at the first ppem, filled from empty and then hit with every glyph cached.
+    if (!_config.ppems.empty())
+    {
+        float const pixelSize = (float)ttfFile.emsize / (float)_config.ppems[0];
+        ttftk::GlyphAtlas atlas{};
+        ttftk::AtlasEntry entry{};
+        RunBench(_config, font, "AcquireGlyph/miss", ttfFile.glyphCount, [&]()
+        {
+            ttftk::CreateGlyphAtlas(ttfFile, pixelSize, 1u, false, 2048u, 2048u, &atlas);
+            for (uint32_t glyphIndex = 0u; glyphIndex < ttfFile.glyphCount; ++glyphIndex)
+            {
+                ttftk::AcquireGlyph(&atlas, glyphIndex, &entry);
+                Consume(entry.rect.width);
+            }
+        }, _results);
+        RunBench(_config, font, "AcquireGlyph/hit", ttfFile.glyphCount, [&]()
+        {
+            ttftk::BeginAtlasFrame(&atlas);
+            for (uint32_t glyphIndex = 0u; glyphIndex < ttfFile.glyphCount; ++glyphIndex)
+            {
+                ttftk::AcquireGlyph(&atlas, glyphIndex, &entry);
+                Consume(entry.rect.width);
+            }
+        }, _results);
+    }
+
+    // Render service at the first ppem. Every glyph is queued as prefetch and the last 16 are then
+    // requested again as visible, the time is per visible glyph until all of them are rendered.
+    // With the same priority they wait behind the prefetch work.
+    if (!_config.ppems.empty())
+    {
+        float const pixelSize = (float)ttfFile.emsize / (float)_config.ppems[0];
+        uint32_t const threadCount = std::max(1u, std::thread::hardware_concurrency());
+        uint32_t const visibleCount = std::min<uint32_t>(16u, ttfFile.glyphCount);
+        ttftk::RenderService* service = ttftk::CreateRenderService(threadCount);
+        std::vector<uint64_t> prefetch{};
+        std::vector<uint64_t> visible{};
+        ttftk::CoverageBitmap bitmap{};
+        auto renderVisible = [&](uint32_t _priority)
+        {
+            prefetch.clear();
+            visible.clear();
+            for (uint32_t glyphIndex = 0u; glyphIndex < ttfFile.glyphCount; ++glyphIndex)
+                prefetch.push_back(ttftk::SubmitRender(service, { &ttfFile, glyphIndex, pixelSize, 1u, false }, 0u));
+            for (uint32_t glyphIndex = ttfFile.glyphCount - visibleCount; glyphIndex < ttfFile.glyphCount; ++glyphIndex)
+                visible.push_back(ttftk::SubmitRender(service, { &ttfFile, glyphIndex, pixelSize, 1u, false }, _priority));
+            for (uint64_t ticket : visible)
+            {
+                ttftk::WaitRender(service, ticket, &bitmap);
+                Consume(bitmap.pixels.size());
+            }
+            for (uint64_t ticket : prefetch)
+                ttftk::CancelRender(service, ticket);
+        };
+        RunBench(_config, font, "RenderService/visible/priority", visibleCount, [&]()
+        {
+            renderVisible(1u);
+        }, _results);
+        RunBench(_config, font, "RenderService/visible/fifo", visibleCount, [&]()
+        {
+            renderVisible(0u);
+        }, _results);
+        RunBench(_config, font, "RenderService/all/threads=" + std::to_string(threadCount), ttfFile.glyphCount, [&]()
+        {
+            prefetch.clear();
+            for (uint32_t glyphIndex = 0u; glyphIndex < ttfFile.glyphCount; ++glyphIndex)
+                prefetch.push_back(ttftk::SubmitRender(service, { &ttfFile, glyphIndex, pixelSize, 1u, false }, 0u));
+            for (uint64_t ticket : prefetch)
+            {
+                ttftk::WaitRender(service, ticket, &bitmap);
+                Consume(bitmap.pixels.size());
+            }
+        }, _results);
+        ttftk::DestroyRenderService(service);
+    }
+
+    // Cached coverage of every glyph at the largest ppem blended into a page, per target format.
+    if (!_config.ppems.empty())
+    {
+        float const pixelSize = (float)ttfFile.emsize / (float)*std::max_element(_config.ppems.begin(), _config.ppems.end());
+        std::vector<ttftk::CoverageBitmap> bitmaps(glyphs.size());
+        for (size_t index = 0u; index < glyphs.size(); ++index)
+            ttftk::RasterizeGlyph(&glyphs[index], pixelSize, 0u, false, &bitmaps[index]);
+
+        static constexpr uint32_t kPageSize = 1024u;
+        std::vector<uint8_t> page(kPageSize * kPageSize * 4u);
+        char const* const formatNames[] = { "gray", "rgb", "rgba" };
+        uint32_t const channelCounts[] = { 1u, 3u, 4u };
+        for (uint32_t format = 0u; format < 3u; ++format)
+        {
+            ttftk::ColorSurface surface{};
+            surface.pixels = page.data();
+            surface.width = surface.height = kPageSize;
+            surface.stride = kPageSize * channelCounts[format];
+            surface.format = (ttftk::PixelFormat)format;
+            RunBench(_config, font, std::string("CompositeCoverage/") + formatNames[format], bitmaps.size(), [&]()
+            {
+                int32_t penX = 0;
+                int32_t penY = 0;
+                for (ttftk::CoverageBitmap const& bitmap : bitmaps)
+                {
+                    ttftk::CompositeCoverage(bitmap, surface, penX, penY, ttftk::Color{ 32u, 64u, 128u, 255u });
+                    penX = (penX + 37) % (int32_t)kPageSize;
+                    penY = (penY + 61) % (int32_t)kPageSize;
+                }
+                Consume(page[0]);
+            }, _results);
+        }
+    }
+
+    // Rasterization only, specialized kernels against the runtime sampling rate path.
+    for (uint32_t ppem : _config.ppems)
+    {
+        float const scale = (float)ppem / (float)ttfFile.emsize;
+        std::vector<ttftk::GlyphOutline> pixelOutlines(glyphs.size());
+        std::vector<ttftk::RasterSurface> surfaces(glyphs.size());
+        std::vector<std::vector<uint8_t>> coverage(glyphs.size());
+        for (size_t index = 0u; index < glyphs.size(); ++index)
+        {
+            ttftk::Glyph const& g = glyphs[index];
+            int32_t const left = (int32_t)std::floor((float)g.xmin * scale) - 1;
+            int32_t const bottom = (int32_t)std::floor((float)g.ymin * scale) - 1;
+            ttftk::TransformGlyph(&g, scale, scale, -(float)left, -(float)bottom, &pixelOutlines[index]);
+
+            surfaces[index].width = (uint32_t)std::ceil(pixelOutlines[index].xmax) + 1;
+            surfaces[index].height = (uint32_t)std::ceil(pixelOutlines[index].ymax) + 1;
+            surfaces[index].stride = surfaces[index].width;
+            coverage[index].resize(surfaces[index].width * surfaces[index].height);
+            surfaces[index].pixels = coverage[index].data();
+        }
+
+        for (uint32_t samplingRate : _config.samplingRates)
+        {
+            for (int subPixelEval = 0; subPixelEval < 2; ++subPixelEval)
+            {
+                std::string const suffix = "/ppem=" + std::to_string(ppem)
+                    + "/rate=" + std::to_string(samplingRate)
+                    + "/subpixel=" + std::to_string(subPixelEval);
+                RunBench(_config, font, "RasterizeOutline" + suffix, glyphs.size(), [&]()
+                {
+                    for (size_t index = 0u; index < pixelOutlines.size(); ++index)
+                        ttftk::RasterizeOutline(&pixelOutlines[index], samplingRate, !!subPixelEval, surfaces[index]);
+                    Consume(coverage[0][0]);
+                }, _results);
+                RunBench(_config, font, "RasterizeOutlineGeneric" + suffix, glyphs.size(), [&]()
+                {
+                    for (size_t index = 0u; index < pixelOutlines.size(); ++index)
+                        ttftk::RasterizeOutlineGeneric(&pixelOutlines[index], samplingRate, !!subPixelEval,
+                                                       surfaces[index]);
+                    Consume(coverage[0][0]);
+                }, _results);
+            }
+        }
+    }
+}
+
+int main(int argc, char const** argv)
+{
+    BenchConfig config{};
+    for (int index = 1; index < argc; ++index)
+    {
+        bool const hasValue = (index + 1 < argc);
+        if (!std::strcmp(argv[index], "--repetitions") && hasValue)
+            config.repetitions = std::max(1, (int)std::strtol(argv[++index], nullptr, 10));
+        else if (!std::strcmp(argv[index], "--warmup") && hasValue)
+            config.warmup = (uint32_t)std::strtol(argv[++index], nullptr, 10);
+        else if (!std::strcmp(argv[index], "--filter") && hasValue)
+            config.filter = argv[++index];
+        else if (!std::strcmp(argv[index], "--json") && hasValue)
+            config.jsonPath = argv[++index];
+        else if (!std::strcmp(argv[index], "--ppem") && hasValue)
+            config.ppems = ParseList(argv[++index]);
+        else if (!std::strcmp(argv[index], "--sampling") && hasValue)
+            config.samplingRates = ParseList(argv[++index]);
+        else
+            config.fonts.push_back(argv[index]);
+    }
+
+    if (config.fonts.empty())
+    {
+        std::cout << "usage: ttftk_bench [--repetitions N] [--warmup N] [--filter substring]"
+                  << " [--json path] [--ppem a,b,...] [--sampling a,b,...] font.ttf..." << std::endl;
+        return 1;
+    }
+
+    std::vector<BenchResult> results{};
+    for (std::string const& font : config.fonts)
+        BenchFont(config, font, results);
+
+    if (!config.jsonPath.empty())
+        WriteJSON(config, results);
+
+    return 0;
+}
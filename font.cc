@@ -1,10 +1,29 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define FONT_REGRESS_FORK
+#endif
+
 #define TTFTK_IMPLEMENTATION
 #include "ttftk.h"
 
@@ -27,17 +46,186 @@ std::vector<uint8_t> LoadFile(char const* _path)
     return memory;
 }
 
-void WriteFile(char const* _path, uint8_t const* _base, uint32_t _size)
+bool WriteFile(char const* _path, uint8_t const* _base, uint32_t _size)
 {
     std::ofstream dest_file(_path, std::ios_base::binary);
     dest_file.write((char const*)_base, (std::streamsize)_size);
+    return dest_file.good();
+}
+
+std::vector<uint32_t> DecodeUTF8(char const* _text)
+{
+    std::vector<uint32_t> output{};
+    uint8_t const* ptr = (uint8_t const*)_text;
+    while (*ptr)
+    {
+        uint32_t charCode = *ptr++;
+        uint32_t continuation = 0u;
+        if (charCode >= 0xf0) { charCode &= 0x07; continuation = 3u; }
+        else if (charCode >= 0xe0) { charCode &= 0x0f; continuation = 2u; }
+        else if (charCode >= 0xc0) { charCode &= 0x1f; continuation = 1u; }
+
+        for (; continuation && (*ptr & 0xc0) == 0x80; --continuation)
+            charCode = (charCode << 6) | (*ptr++ & 0x3f);
+
+        output.push_back(charCode);
+    }
+    return output;
 }
 
+struct AtlasSettings
+{
+    uint32_t glyphCountX, glyphCountY;
+    uint32_t ppem;
+    uint32_t samplingRate;
+    bool subPixelEval;
+    uint32_t charListOffset;
+};
+
+// Bounded lock free queue for any number of producers and consumers (Vyukov's sequence per cell
+// ring). Push blocks while the queue is full, which is the backpressure between pipeline stages.
+// Pop blocks while it is empty and returns false once it has been closed and drained.
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(std::size_t _capacity)
+    {
+        std::size_t capacity = 1u;
+        while (capacity < _capacity)
+            capacity <<= 1u;
+        cells_.reset(new Cell[capacity]);
+        mask_ = capacity - 1u;
+        for (std::size_t index = 0u; index < capacity; ++index)
+            cells_[index].sequence.store(index, std::memory_order_relaxed);
+    }
+
+    bool TryPush(T&& _value)
+    {
+        std::size_t position = tail_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = cells_[position & mask_];
+            std::size_t const sequence = cell.sequence.load(std::memory_order_acquire);
+            std::intptr_t const lag = (std::intptr_t)sequence - (std::intptr_t)position;
+            if (lag == 0)
+            {
+                if (tail_.compare_exchange_weak(position, position + 1u, std::memory_order_relaxed))
+                {
+                    cell.value = std::move(_value);
+                    cell.sequence.store(position + 1u, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (lag < 0)
+                return false;
+            else
+                position = tail_.load(std::memory_order_relaxed);
+        }
+    }
+
+    bool TryPop(T* _value)
+    {
+        std::size_t position = head_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = cells_[position & mask_];
+            std::size_t const sequence = cell.sequence.load(std::memory_order_acquire);
+            std::intptr_t const lag = (std::intptr_t)sequence - (std::intptr_t)(position + 1u);
+            if (lag == 0)
+            {
+                if (head_.compare_exchange_weak(position, position + 1u, std::memory_order_relaxed))
+                {
+                    *_value = std::move(cell.value);
+                    cell.sequence.store(position + mask_ + 1u, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (lag < 0)
+                return false;
+            else
+                position = head_.load(std::memory_order_relaxed);
+        }
+    }
+
+    void Push(T&& _value)
+    {
+        for (;;)
+        {
+            // The pop count is read before trying, so a pop in between makes the wait return at once.
+            std::uint32_t const popped = popped_.load(std::memory_order_acquire);
+            if (TryPush(std::move(_value)))
+                break;
+            popped_.wait(popped, std::memory_order_acquire);
+        }
+        pushed_.fetch_add(1u, std::memory_order_release);
+        pushed_.notify_one();
+    }
+
+    bool Pop(T* _value)
+    {
+        for (;;)
+        {
+            std::uint32_t const pushed = pushed_.load(std::memory_order_acquire);
+            if (TryPop(_value))
+                break;
+            if (closed_.load(std::memory_order_acquire))
+                return TryPop(_value);
+            pushed_.wait(pushed, std::memory_order_acquire);
+        }
+        popped_.fetch_add(1u, std::memory_order_release);
+        popped_.notify_one();
+        return true;
+    }
+
+    void Close()
+    {
+        closed_.store(true, std::memory_order_release);
+        pushed_.fetch_add(1u, std::memory_order_release);
+        pushed_.notify_all();
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    std::size_t mask_;
+    alignas(64) std::atomic<std::size_t> head_{ 0u };
+    alignas(64) std::atomic<std::size_t> tail_{ 0u };
+    std::atomic<bool> closed_{ false };
+    // Push and pop counts Pop and Push block on, only their changes matter.
+    alignas(64) std::atomic<std::uint32_t> pushed_{ 0u };
+    alignas(64) std::atomic<std::uint32_t> popped_{ 0u };
+};
+
+// Decoded glyphs by glyph index, filled before rendering and then only read.
+using GlyphCache = std::unordered_map<uint32_t, ttftk::Glyph>;
+
+void RenderAtlas(ttftk::TrueTypeFile const& _ttfFile, AtlasSettings const& _settings,
+                 bmptk::BitmapV1Header* _header, std::vector<bmptk::PixelValue>* _pixels);
+// Glyphs come from _glyphCache when given, glyphs missing from it are left out. Otherwise they are
+// decoded on a separate thread while this one rasterizes.
+void RenderAtlasCells(ttftk::TrueTypeFile const& _ttfFile, AtlasSettings const& _settings,
+                      uint32_t const* _cellCodes, std::size_t _cellCount, GlyphCache const* _glyphCache,
+                      bmptk::BitmapV1Header* _header, std::vector<bmptk::PixelValue>* _pixels);
+int RenderText(ttftk::TrueTypeFile const& _ttfFile, int argc, char const** argv);
+int CompileFontCache(ttftk::TrueTypeFile const& _ttfFile, int argc, char const** argv);
+int WriteSubsetFont(ttftk::TrueTypeFile const& _ttfFile, int argc, char const** argv);
+int RunRegression(int argc, char const** argv);
+int RunBatch(int argc, char const** argv);
+void PrintInstrumentationReport();
 void RenderGlyph(ttftk::TrueTypeFile const& _ttfFile, ttftk::Glyph const& _glyph);
 void RenderGlyph(ttftk::TrueTypeFile const& _ttfFile, ttftk::Glyph const& _glyph,
                  bmptk::BitmapV1Header const& _header, bmptk::PixelValue *_pixels,
                  uint32_t xres, uint32_t yres, uint32_t xOffset, uint32_t yOffset,
-                 uint32_t samplingRate, float pixelSize, bool subPixelEval);
+                 uint32_t samplingRate, bool subPixelEval);
+void CompositeWhite(uint8_t const* _coverage, uint32_t _width, uint32_t _height,
+                    bmptk::BitmapV1Header const& _header, bmptk::PixelValue* _pixels,
+                    uint32_t _x, uint32_t _y);
 
 int main(int argc, char const ** argv)
 {
@@ -47,6 +235,15 @@ int main(int argc, char const ** argv)
         return 1;
     }
 
+#ifdef TTFTK_INSTRUMENTATION
+    std::atexit(PrintInstrumentationReport);
+#endif
+
+    if (std::strcmp(argv[1], "--regress") == 0)
+        return RunRegression(argc, argv);
+    if (std::strcmp(argv[1], "--batch") == 0)
+        return RunBatch(argc, argv);
+
     std::vector<uint8_t> memory = LoadFile(argv[1]);
     uint32_t iCharCode = ~0u;
     uint32_t glyphCountX = 10;
@@ -67,6 +264,13 @@ int main(int argc, char const ** argv)
         return 1;
     }
 
+    if (argc > 3 && std::strcmp(argv[2], "--text") == 0)
+        return RenderText(ttfFile, argc, argv);
+    if (argc > 3 && std::strcmp(argv[2], "--compile") == 0)
+        return CompileFontCache(ttfFile, argc, argv);
+    if (argc > 4 && std::strcmp(argv[2], "--subset") == 0)
+        return WriteSubsetFont(ttfFile, argc, argv);
+
     ttftk::Glyph glyph{};
     if (iCharCode != ~0u)
     {
@@ -106,51 +310,756 @@ int main(int argc, char const ** argv)
             ? std::strtol(argv[8], nullptr, 10)
             : 0u;
 
+        AtlasSettings settings{};
+        settings.glyphCountX = glyphCountX;
+        settings.glyphCountY = glyphCountY;
+        settings.ppem = ppem;
+        settings.samplingRate = samplingRate;
+        settings.subPixelEval = !!subPixelEval;
+        settings.charListOffset = charListOffset;
+
+        bmptk::BitmapV1Header header{};
+        std::vector<bmptk::PixelValue> pixels{};
+        RenderAtlas(ttfFile, settings, &header, &pixels);
+
+        TTFTK_SCOPED_TIMER(ttftk::Stage::Encode);
+        std::vector<uint8_t> memory(bmptk::AllocSize(&header));
+        bmptk::WriteBMP(&header, pixels.data(), memory.data());
+        char const* outpath = "testfile.bmp";
+        if (argc > 4)
+            outpath = argv[4];
+        WriteFile(outpath, memory.data(), memory.size());
+    }
+
+    return 0;
+}
+
+// font <ttf> --text <utf8 text> [output] [ppem] [samplingRate] [subPixelEval]
+int RenderText(ttftk::TrueTypeFile const& _ttfFile, int argc, char const** argv)
+{
+    uint32_t const ppem = (argc > 5)
+        ? std::strtol(argv[5], nullptr, 10)
+        : 32;
+
+    uint32_t const samplingRate = (argc > 6)
+        ? std::strtol(argv[6], nullptr, 10)
+        : 0u;
+
+    uint32_t const subPixelEval = (argc > 7)
+        ? std::strtol(argv[7], nullptr, 10)
+        : 0u;
+
+    std::vector<uint32_t> charCodes = DecodeUTF8(argv[3]);
+    ttftk::KerningTable kerning{};
+    ttftk::CompileKerning(_ttfFile, &kerning);
+    ttftk::TextRun run{};
+    if (ttftk::LayoutText(_ttfFile, charCodes.data(), charCodes.size(), &run, &kerning)
+        != ttftk::Result::Success)
+    {
+        std::cout << "error laying out text" << std::endl;
+        return 1;
+    }
+
+    float const pixelSize = (float)_ttfFile.emsize / (float)ppem;
+    int32_t const paddingLeft = (int32_t)std::ceil((float)std::max(0, -(int32_t)_ttfFile.xmin) / pixelSize) + 1;
+    int32_t const paddingRight =
+        (int32_t)std::ceil((float)std::max(0, _ttfFile.xmax - (int32_t)_ttfFile.advanceWidthMax) / pixelSize) + 1;
+    int32_t const ascent = (int32_t)std::ceil((float)_ttfFile.ascent / pixelSize);
+    int32_t const descent = (int32_t)std::ceil((float)-_ttfFile.descent / pixelSize);
+
+    bmptk::BitmapV1Header header{};
+    header.width = paddingLeft + (int32_t)std::ceil((float)run.advance / pixelSize) + paddingRight;
+    header.height = -(ascent + descent);
 
-        float const xtoemRatio = (float)(ttfFile.xmax - ttfFile.xmin) / (float)ttfFile.emsize;
-        float const ytoemRatio = (float)(ttfFile.ymax - ttfFile.ymin) / (float)ttfFile.emsize;
-        uint32_t const gridSizeX = (uint32_t)std::round(xtoemRatio * (float)ppem);
-        uint32_t const gridSizeY = (uint32_t)std::round(ytoemRatio * (float)ppem);
-        float const pixelSize = (float)ttfFile.emsize / (float)ppem;
+    std::vector<uint8_t> coverage(std::abs(header.width * header.height), 0u);
+    ttftk::RasterSurface surface{};
+    surface.pixels = coverage.data();
+    surface.width = (uint32_t)header.width;
+    surface.height = (uint32_t)-header.height;
+    surface.stride = surface.width;
 
+    ttftk::RenderScratch scratch{};
+    ttftk::RenderTextRun(_ttfFile, run, pixelSize, samplingRate, !!subPixelEval,
+                         surface, paddingLeft, ascent, &scratch);
+
+    std::vector<bmptk::PixelValue> pixels(coverage.size());
+    CompositeWhite(coverage.data(), surface.width, surface.height, header, pixels.data(), 0u, 0u);
+
+    TTFTK_SCOPED_TIMER(ttftk::Stage::Encode);
+    std::vector<uint8_t> memory(bmptk::AllocSize(&header));
+    bmptk::WriteBMP(&header, pixels.data(), memory.data());
+    char const* outpath = "testfile.bmp";
+    if (argc > 4)
+        outpath = argv[4];
+    WriteFile(outpath, memory.data(), memory.size());
+
+    return 0;
+}
+
+struct RegressionCase
+{
+    size_t line;
+    std::string font;
+    AtlasSettings settings;
+    bool hasBaseline;
+    uint64_t hash;
+    double wallMs;
+    uint64_t peakRssKB;
+};
+
+struct RegressionMeasure
+{
+    bool valid;
+    uint64_t hash;
+    double wallMs;
+    uint64_t peakRssKB;
+};
+
+uint64_t HashPixels(bmptk::BitmapV1Header const& _header, std::vector<bmptk::PixelValue> const& _pixels)
+{
+    // FNV-1a 64 over the dimensions and pixel data.
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto const feed = [&hash](uint8_t const* _bytes, size_t _size)
+    {
+        for (size_t index = 0u; index < _size; ++index)
+            hash = (hash ^ _bytes[index]) * 0x100000001b3ull;
+    };
+    feed((uint8_t const*)&_header.width, sizeof(_header.width));
+    feed((uint8_t const*)&_header.height, sizeof(_header.height));
+    for (bmptk::PixelValue const& pixel : _pixels)
+    {
+        uint8_t const rgb[3] = { (uint8_t)pixel.d[0], (uint8_t)pixel.d[1], (uint8_t)pixel.d[2] };
+        feed(rgb, 3);
+    }
+    return hash;
+}
+
+RegressionMeasure MeasureRegressionCase(RegressionCase const& _case, uint32_t _repeat)
+{
+    RegressionMeasure measure{};
+
+    std::vector<uint8_t> memory = LoadFile(_case.font.c_str());
+    ttftk::TrueTypeFile ttfFile{};
+    if (memory.empty() || ttftk::LoadTTF(memory.data(), &ttfFile) != ttftk::Result::Success)
+        return measure;
+
+    measure.wallMs = std::numeric_limits<double>::infinity();
+    for (uint32_t index = 0u; index < _repeat; ++index)
+    {
+        auto const begin = std::chrono::steady_clock::now();
         bmptk::BitmapV1Header header{};
-        header.width = gridSizeX * glyphCountX;
-        header.height = -gridSizeY * glyphCountY;
+        std::vector<bmptk::PixelValue> pixels{};
+        RenderAtlas(ttfFile, _case.settings, &header, &pixels);
+        auto const end = std::chrono::steady_clock::now();
 
-        std::vector<bmptk::PixelValue> pixels(std::abs(header.width * header.height));
-        std::memset(pixels.data(), 0, sizeof(bmptk::PixelValue)*pixels.size());
-        std::vector<uint32_t> charList = ttftk::ListCharCodes(ttfFile);
-        bmptk::PixelValue* const pixelBuffer = pixels.data();
+        measure.wallMs = std::min(measure.wallMs,
+                                  std::chrono::duration<double, std::milli>(end - begin).count());
+        measure.hash = HashPixels(header, pixels);
+    }
+
+    measure.valid = true;
+    return measure;
+}
+
+// Each case runs in its own process where available so that the peak RSS is per case.
+RegressionMeasure RunRegressionCase(RegressionCase const& _case, uint32_t _repeat)
+{
+#ifdef FONT_REGRESS_FORK
+    int fds[2];
+    if (pipe(fds) != 0)
+        return {};
+
+    pid_t const pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        RegressionMeasure measure = MeasureRegressionCase(_case, _repeat);
+        ssize_t const written = write(fds[1], &measure, sizeof(measure));
+        _exit(written == (ssize_t)sizeof(measure) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    RegressionMeasure measure{};
+    ssize_t const readSize = (pid > 0) ? read(fds[0], &measure, sizeof(measure)) : 0;
+    close(fds[0]);
+    if (pid < 0)
+        return {};
+
+    int status = 0;
+    struct rusage usage{};
+    wait4(pid, &status, 0, &usage);
+    if (readSize != (ssize_t)sizeof(measure) || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return {};
+
+#if defined(__APPLE__)
+    measure.peakRssKB = (uint64_t)usage.ru_maxrss / 1024u;
+#else
+    measure.peakRssKB = (uint64_t)usage.ru_maxrss;
+#endif
+    return measure;
+#else
+    return MeasureRegressionCase(_case, _repeat);
+#endif
+}
+
+// font <ttf> --compile <output>
+int CompileFontCache(ttftk::TrueTypeFile const& _ttfFile, int argc, char const** argv)
+{
+    std::vector<uint8_t> blob{};
+    ttftk::CompileFont(_ttfFile, &blob);
+
+    ttftk::CompiledFont compiled{};
+    if (ttftk::OpenCompiledFont(blob.data(), blob.size(), &compiled, true) != ttftk::Result::Success)
+    {
+        std::cout << "error compiling font" << std::endl;
+        return 1;
+    }
+
+    {
+        TTFTK_SCOPED_TIMER(ttftk::Stage::Encode);
+        WriteFile(argv[3], blob.data(), (uint32_t)blob.size());
+    }
+    std::cout << compiled.header->glyphCount << " glyphs, " << compiled.header->charRangeCount
+              << " character ranges, " << blob.size() << " bytes" << std::endl;
+    return 0;
+}
+
+// font <ttf> --subset <utf8 text> <output>
+int WriteSubsetFont(ttftk::TrueTypeFile const& _ttfFile, int argc, char const** argv)
+{
+    std::vector<uint32_t> const charCodes = DecodeUTF8(argv[3]);
+    std::vector<uint8_t> output{};
+    ttftk::TrueTypeFile subset{};
+    if (ttftk::SubsetFont(_ttfFile, charCodes.data(), charCodes.size(), &output) != ttftk::Result::Success
+        || ttftk::LoadTTF(output.data(), &subset) != ttftk::Result::Success)
+    {
+        std::cout << "error subsetting font" << std::endl;
+        return 1;
+    }
+
+    WriteFile(argv[4], output.data(), (uint32_t)output.size());
+    std::cout << subset.glyphCount << " glyphs, " << output.size() << " bytes" << std::endl;
+    return 0;
+}
+
+struct BatchJob
+{
+    std::string font;
+    std::string output;
+    std::string codes;
+    AtlasSettings settings;
+    uint32_t fontIndex;
+    std::vector<uint32_t> cellCodes;
+    double renderMs;
+    double encodeMs;
+    bool written;
+};
 
-        uint32_t glyphX = 0;
-        uint32_t glyphY = 0;
-        for (std::size_t index = 0u; index < charList.size()-charListOffset; ++index)
+struct BatchFont
+{
+    std::vector<uint8_t> memory;
+    ttftk::TrueTypeFile ttfFile;
+    GlyphCache glyphCache;
+};
+
+// 'all' or comma separated hex code points and ranges, e.g. 20-7e,a0-ff. Ranges are clamped to
+// 10ffff. Returns false on an item that is not a code point or an ascending range.
+bool ParseCodeSet(std::string const& _codes, std::vector<uint32_t> const& _charList, std::vector<uint32_t>* _output)
+{
+    std::vector<uint32_t>& output = *_output;
+    if (_codes == "all")
+    {
+        output = _charList;
+        return true;
+    }
+
+    output.clear();
+    std::istringstream items(_codes);
+    std::string item{};
+    while (std::getline(items, item, ','))
+    {
+        char const* text = item.c_str();
+        char* end = nullptr;
+        if (!std::isxdigit((unsigned char)*text))
+            return false;
+        unsigned long const first = std::strtoul(text, &end, 16);
+        unsigned long last = first;
+        if (*end == '-')
         {
-            uint32_t charCode = charList[index + charListOffset];
-            ttftk::ReadGlyphData(ttfFile, charCode, &glyph);
-            RenderGlyph(ttfFile, glyph, header, pixelBuffer,
-                        gridSizeX, gridSizeY, glyphX * gridSizeX, glyphY * gridSizeY,
-                        samplingRate, pixelSize, !!subPixelEval);
+            text = end + 1;
+            if (!std::isxdigit((unsigned char)*text))
+                return false;
+            last = std::strtoul(text, &end, 16);
+        }
+        if (*end != '\0' || first > 0x10FFFFul || last < first)
+            return false;
+
+        for (uint32_t charCode = (uint32_t)first; charCode <= std::min(last, 0x10FFFFul); ++charCode)
+            output.push_back(charCode);
+    }
+    return !_codes.empty();
+}
+
+// font --batch <manifest> [--threads N]
+//
+// Manifest lines, '#' starts a comment:
+//   font output glyphCountX glyphCountY ppem samplingRate subPixelEval codes
+// Each font is loaded once and every glyph its jobs use is decoded once, in glyf order, then shared
+// by the jobs. Jobs render concurrently while a separate thread encodes and writes finished atlases.
+int RunBatch(int argc, char const** argv)
+{
+    if (argc < 3)
+    {
+        std::cout << "Missing path to batch manifest." << std::endl;
+        return 1;
+    }
+
+    uint32_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+    for (int index = 3; index < argc; ++index)
+    {
+        if (std::strcmp(argv[index], "--threads") == 0 && index + 1 < argc)
+            threadCount = (uint32_t)std::max(1l, std::strtol(argv[++index], nullptr, 10));
+    }
+
+    auto const begin = std::chrono::steady_clock::now();
+    auto const elapsedMs = [](std::chrono::steady_clock::time_point _from)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _from).count();
+    };
+
+    std::vector<BatchJob> jobs{};
+    {
+        std::ifstream manifest(argv[2]);
+        std::string line{};
+        while (std::getline(manifest, line))
+        {
+            std::istringstream fields(line);
+            BatchJob job{};
+            uint32_t subPixelEval = 0u;
+            if (line.empty() || line[0] == '#'
+                || !(fields >> job.font >> job.output
+                     >> job.settings.glyphCountX >> job.settings.glyphCountY
+                     >> job.settings.ppem >> job.settings.samplingRate >> subPixelEval >> job.codes))
+                continue;
+
+            job.settings.subPixelEval = !!subPixelEval;
+            jobs.push_back(job);
+        }
+    }
+
+    if (jobs.empty())
+    {
+        std::cout << "no job in " << argv[2] << std::endl;
+        return 1;
+    }
+
+    // Fonts are owned by a list so that TrueTypeFile table pointers stay put.
+    std::vector<std::unique_ptr<BatchFont>> fonts{};
+    std::vector<std::string> fontPaths{};
+    for (BatchJob& job : jobs)
+    {
+        auto const known = std::find(fontPaths.begin(), fontPaths.end(), job.font);
+        job.fontIndex = (uint32_t)(known - fontPaths.begin());
+        if (known != fontPaths.end())
+            continue;
+
+        fontPaths.push_back(job.font);
+        fonts.push_back(std::make_unique<BatchFont>());
+        BatchFont& font = *fonts.back();
+        font.memory = LoadFile(job.font.c_str());
+        if (font.memory.empty() || ttftk::LoadTTF(font.memory.data(), &font.ttfFile) != ttftk::Result::Success)
+        {
+            std::cout << "error parsing ttf " << job.font << std::endl;
+            return 1;
+        }
+    }
 
-            ++glyphX;
-            if (glyphX >= glyphCountX)
+    for (uint32_t fontIndex = 0u; fontIndex < fonts.size(); ++fontIndex)
+    {
+        BatchFont& font = *fonts[fontIndex];
+        std::vector<uint32_t> const charList = ttftk::ListCharCodes(font.ttfFile);
+
+        std::vector<uint32_t> usedCodes{};
+        for (BatchJob& job : jobs)
+        {
+            if (job.fontIndex != fontIndex)
+                continue;
+            if (!ParseCodeSet(job.codes, charList, &job.cellCodes))
             {
-                glyphX = 0;
-                ++glyphY;
-                if (glyphY >= glyphCountY)
-                    break;
+                std::cout << "invalid code set " << job.codes << " for " << job.output << std::endl;
+                return 1;
             }
+            std::size_t const cellCount = std::min<std::size_t>(
+                job.cellCodes.size(), (std::size_t)job.settings.glyphCountX * job.settings.glyphCountY);
+            usedCodes.insert(usedCodes.end(), job.cellCodes.begin(), job.cellCodes.begin() + cellCount);
         }
 
-        std::vector<uint8_t> memory(bmptk::AllocSize(&header));
-        bmptk::WriteBMP(&header, pixels.data(), memory.data());
-        char const* outpath = "testfile.bmp";
-        if (argc > 4)
-            outpath = argv[4];
-        WriteFile(outpath, memory.data(), memory.size());
+        std::vector<ttftk::CharGlyphPair> const glyphs =
+            ttftk::ListGlyphsInFileOrder(font.ttfFile, usedCodes.data(), usedCodes.size());
+        for (ttftk::CharGlyphPair const& entry : glyphs)
+        {
+            ttftk::Glyph glyph{};
+            if (ttftk::ReadGlyphIndexData(font.ttfFile, entry.glyphIndex, &glyph) == ttftk::Result::Success)
+                font.glyphCache.emplace(entry.glyphIndex, std::move(glyph));
+        }
     }
+    double const loadMs = elapsedMs(begin);
 
-    return 0;
+    // Render workers hand finished atlases to a single encoder thread, the queue bounds how many
+    // rendered atlases wait in memory.
+    struct RenderedAtlas
+    {
+        uint32_t jobIndex;
+        bmptk::BitmapV1Header header;
+        std::vector<bmptk::PixelValue> pixels;
+    };
+    BoundedQueue<RenderedAtlas> rendered(4u);
+
+    uint32_t failures = 0u;
+    std::thread encoder([&]()
+    {
+        RenderedAtlas atlas{};
+        while (rendered.Pop(&atlas))
+        {
+            BatchJob& job = jobs[atlas.jobIndex];
+            auto const encodeBegin = std::chrono::steady_clock::now();
+            TTFTK_SCOPED_TIMER(ttftk::Stage::Encode);
+            std::vector<uint8_t> memory(bmptk::AllocSize(&atlas.header));
+            bmptk::WriteBMP(&atlas.header, atlas.pixels.data(), memory.data());
+            job.written = WriteFile(job.output.c_str(), memory.data(), memory.size());
+            if (!job.written)
+                ++failures;
+            job.encodeMs = elapsedMs(encodeBegin);
+        }
+    });
+
+    std::atomic<uint32_t> nextJob{ 0u };
+    auto const worker = [&]()
+    {
+        for (uint32_t jobIndex = nextJob++; jobIndex < jobs.size(); jobIndex = nextJob++)
+        {
+            BatchJob& job = jobs[jobIndex];
+            BatchFont const& font = *fonts[job.fontIndex];
+
+            auto const renderBegin = std::chrono::steady_clock::now();
+            RenderedAtlas atlas{};
+            atlas.jobIndex = jobIndex;
+            RenderAtlasCells(font.ttfFile, job.settings, job.cellCodes.data(), job.cellCodes.size(),
+                             &font.glyphCache, &atlas.header, &atlas.pixels);
+            job.renderMs = elapsedMs(renderBegin);
+            rendered.Push(std::move(atlas));
+        }
+    };
+
+    std::vector<std::thread> workers{};
+    for (uint32_t index = 1u; index < std::min<uint32_t>(threadCount, (uint32_t)jobs.size()); ++index)
+        workers.emplace_back(worker);
+    worker();
+    for (std::thread& thread : workers)
+        thread.join();
+    rendered.Close();
+    encoder.join();
+
+    for (BatchJob const& job : jobs)
+    {
+        char report[512];
+        std::snprintf(report, sizeof(report),
+                      "%s %-24s %ux%u ppem %u rate %u subpixel %u  %9.2f ms render  %7.2f ms encode",
+                      job.written ? "DONE " : "ERROR", job.output.c_str(), job.settings.glyphCountX, job.settings.glyphCountY, job.settings.ppem,
+                      job.settings.samplingRate, (uint32_t)job.settings.subPixelEval, job.renderMs, job.encodeMs);
+        std::cout << report << std::endl;
+    }
+
+    char summary[256];
+    std::snprintf(summary, sizeof(summary), "%zu jobs, %zu fonts, %u threads  %.2f ms load+decode  %.2f ms total",
+                  jobs.size(), fonts.size(), threadCount, loadMs, elapsedMs(begin));
+    std::cout << summary << std::endl;
+    return failures ? 1 : 0;
+}
+
+// font --regress <manifest> [--update] [--repeat N] [--time-tolerance F] [--rss-tolerance F]
+//
+// Manifest lines, '#' starts a comment:
+//   font glyphCountX glyphCountY ppem samplingRate subPixelEval charListOffset [hash wallMs peakRssKB]
+// Cases without a baseline, or all cases with --update, get their measured values written back.
+// Tolerances are relative, a hash mismatch always fails.
+int RunRegression(int argc, char const** argv)
+{
+    if (argc < 3)
+    {
+        std::cout << "Missing path to regression manifest." << std::endl;
+        return 1;
+    }
+
+    char const* manifestPath = argv[2];
+    bool update = false;
+    uint32_t repeat = 3u;
+    double timeTolerance = 0.15;
+    double rssTolerance = 0.10;
+    for (int index = 3; index < argc; ++index)
+    {
+        bool const hasValue = (index + 1 < argc);
+        if (std::strcmp(argv[index], "--update") == 0)
+            update = true;
+        else if (std::strcmp(argv[index], "--repeat") == 0 && hasValue)
+            repeat = std::max(1l, std::strtol(argv[++index], nullptr, 10));
+        else if (std::strcmp(argv[index], "--time-tolerance") == 0 && hasValue)
+            timeTolerance = std::strtod(argv[++index], nullptr);
+        else if (std::strcmp(argv[index], "--rss-tolerance") == 0 && hasValue)
+            rssTolerance = std::strtod(argv[++index], nullptr);
+    }
+
+    std::vector<std::string> lines{};
+    std::vector<RegressionCase> cases{};
+    {
+        std::ifstream manifest(manifestPath);
+        std::string line{};
+        while (std::getline(manifest, line))
+        {
+            std::istringstream fields(line);
+            RegressionCase regressionCase{};
+            uint32_t subPixelEval = 0u;
+            lines.push_back(line);
+            if (line.empty() || line[0] == '#'
+                || !(fields >> regressionCase.font
+                     >> regressionCase.settings.glyphCountX >> regressionCase.settings.glyphCountY
+                     >> regressionCase.settings.ppem >> regressionCase.settings.samplingRate
+                     >> subPixelEval >> regressionCase.settings.charListOffset))
+                continue;
+
+            regressionCase.line = lines.size() - 1;
+            regressionCase.settings.subPixelEval = !!subPixelEval;
+            regressionCase.hasBaseline = !!(fields >> std::hex >> regressionCase.hash >> std::dec
+                                            >> regressionCase.wallMs >> regressionCase.peakRssKB);
+            cases.push_back(regressionCase);
+        }
+    }
+
+    if (cases.empty())
+    {
+        std::cout << "no regression case in " << manifestPath << std::endl;
+        return 1;
+    }
+
+    uint32_t failures = 0u;
+    bool baselineChanged = false;
+    for (RegressionCase& regressionCase : cases)
+    {
+        RegressionMeasure const measure = RunRegressionCase(regressionCase, repeat);
+        AtlasSettings const& settings = regressionCase.settings;
+
+        char description[256];
+        std::snprintf(description, sizeof(description), "%s %ux%u ppem %u rate %u subpixel %u offset %u",
+                      regressionCase.font.c_str(), settings.glyphCountX, settings.glyphCountY,
+                      settings.ppem, settings.samplingRate, (uint32_t)settings.subPixelEval,
+                      settings.charListOffset);
+
+        if (!measure.valid)
+        {
+            std::cout << "ERROR " << description << std::endl;
+            ++failures;
+            continue;
+        }
+
+        char report[256];
+        std::snprintf(report, sizeof(report), "hash %016llx  %9.2f ms  %8llu KB",
+                      (unsigned long long)measure.hash, measure.wallMs,
+                      (unsigned long long)measure.peakRssKB);
+
+        if (update || !regressionCase.hasBaseline)
+        {
+            std::cout << "NEW   " << description << "  " << report << std::endl;
+            regressionCase.hash = measure.hash;
+            regressionCase.wallMs = measure.wallMs;
+            regressionCase.peakRssKB = measure.peakRssKB;
+            regressionCase.hasBaseline = true;
+            baselineChanged = true;
+            continue;
+        }
+
+        bool const hashMatch = (measure.hash == regressionCase.hash);
+        bool const timeMatch = measure.wallMs <= regressionCase.wallMs * (1.0 + timeTolerance);
+        bool const rssMatch = !measure.peakRssKB || !regressionCase.peakRssKB
+            || (double)measure.peakRssKB <= (double)regressionCase.peakRssKB * (1.0 + rssTolerance);
+
+        std::snprintf(report + std::strlen(report), sizeof(report) - std::strlen(report),
+                      "  (time %+.1f%%, rss %+.1f%%)",
+                      100.0 * (measure.wallMs / regressionCase.wallMs - 1.0),
+                      regressionCase.peakRssKB
+                      ? 100.0 * ((double)measure.peakRssKB / (double)regressionCase.peakRssKB - 1.0)
+                      : 0.0);
+
+        char const* status = !hashMatch ? "PIXEL" : (!timeMatch ? "SLOW " : (!rssMatch ? "RSS  " : "PASS "));
+        std::cout << status << " " << description << "  " << report << std::endl;
+        if (!(hashMatch && timeMatch && rssMatch))
+            ++failures;
+    }
+
+    if (baselineChanged)
+    {
+        for (RegressionCase const& regressionCase : cases)
+        {
+            AtlasSettings const& settings = regressionCase.settings;
+            char line[512];
+            std::snprintf(line, sizeof(line), "%s %u %u %u %u %u %u %016llx %.3f %llu",
+                          regressionCase.font.c_str(), settings.glyphCountX, settings.glyphCountY,
+                          settings.ppem, settings.samplingRate, (uint32_t)settings.subPixelEval,
+                          settings.charListOffset, (unsigned long long)regressionCase.hash,
+                          regressionCase.wallMs, (unsigned long long)regressionCase.peakRssKB);
+            lines[regressionCase.line] = line;
+        }
+
+        std::ofstream manifest(manifestPath);
+        for (std::string const& line : lines)
+            manifest << line << std::endl;
+    }
+
+    std::cout << cases.size() - failures << "/" << cases.size() << " passed" << std::endl;
+    return failures ? 1 : 0;
+}
+
+void RenderAtlas(ttftk::TrueTypeFile const& _ttfFile, AtlasSettings const& _settings,
+                 bmptk::BitmapV1Header* _header, std::vector<bmptk::PixelValue>* _pixels)
+{
+    std::vector<uint32_t> const charList = ttftk::ListCharCodes(_ttfFile);
+    std::size_t const listOffset = std::min<std::size_t>(_settings.charListOffset, charList.size());
+    RenderAtlasCells(_ttfFile, _settings, charList.data() + listOffset, charList.size() - listOffset, nullptr,
+                     _header, _pixels);
+}
+
+void RenderAtlasCells(ttftk::TrueTypeFile const& _ttfFile, AtlasSettings const& _settings,
+                      uint32_t const* _cellCodes, std::size_t _cellCount, GlyphCache const* _glyphCache,
+                      bmptk::BitmapV1Header* _header, std::vector<bmptk::PixelValue>* _pixels)
+{
+    float const xtoemRatio = (float)(_ttfFile.xmax - _ttfFile.xmin) / (float)_ttfFile.emsize;
+    float const ytoemRatio = (float)(_ttfFile.ymax - _ttfFile.ymin) / (float)_ttfFile.emsize;
+    uint32_t const gridSizeX = (uint32_t)std::round(xtoemRatio * (float)_settings.ppem);
+    uint32_t const gridSizeY = (uint32_t)std::round(ytoemRatio * (float)_settings.ppem);
+
+    bmptk::BitmapV1Header& header = *_header;
+    header = {};
+    header.width = gridSizeX * _settings.glyphCountX;
+    header.height = -gridSizeY * _settings.glyphCountY;
+
+    std::vector<bmptk::PixelValue>& pixels = *_pixels;
+    pixels.resize(std::abs(header.width * header.height));
+    std::memset(pixels.data(), 0, sizeof(bmptk::PixelValue)*pixels.size());
+    bmptk::PixelValue* const pixelBuffer = pixels.data();
+
+    std::size_t const cellCount = std::min<std::size_t>(_cellCount,
+                                                        (std::size_t)_settings.glyphCountX * _settings.glyphCountY);
+    uint32_t const* const cellCodes = _cellCodes;
+
+    auto cellPixels = [&](std::size_t _cell)
+    {
+        uint32_t const cellX = (uint32_t)(_cell % _settings.glyphCountX) * gridSizeX;
+        uint32_t const cellY = (uint32_t)(_cell / _settings.glyphCountX) * gridSizeY;
+        return pixelBuffer + cellX + cellY * header.width;
+    };
+
+    // Cells stay in character code order while glyphs are decoded in glyf order, each distinct
+    // glyph is rendered once in its first cell and copied to the other cells using it. Each cell's
+    // glyph is looked up once and shared by both.
+    std::vector<ttftk::CharGlyphPair> cellGlyphs(cellCount);
+    std::unordered_map<uint32_t, std::size_t> firstCells{};
+    for (std::size_t cell = 0u; cell < cellCount; ++cell)
+    {
+        cellGlyphs[cell] = ttftk::CharGlyphPair{ cellCodes[cell], ttftk::GetGlyphIndex(_ttfFile, cellCodes[cell]) };
+        firstCells.emplace(cellGlyphs[cell].glyphIndex, cell);
+    }
+
+    std::vector<ttftk::CharGlyphPair> glyphs(cellGlyphs);
+    ttftk::SortGlyphsInFileOrder(_ttfFile, &glyphs);
+    auto const renderGlyph = [&](uint32_t _glyphIndex, ttftk::Glyph const* _source)
+    {
+        if (!_source)
+        {
+            firstCells.erase(_glyphIndex);
+            return;
+        }
+
+        std::size_t const cell = firstCells[_glyphIndex];
+        RenderGlyph(_ttfFile, *_source, header, pixelBuffer,
+                    gridSizeX, gridSizeY,
+                    (uint32_t)(cell % _settings.glyphCountX) * gridSizeX,
+                    (uint32_t)(cell / _settings.glyphCountX) * gridSizeY,
+                    _settings.samplingRate, _settings.subPixelEval);
+    };
+
+    if (_glyphCache)
+    {
+        for (ttftk::CharGlyphPair const& entry : glyphs)
+        {
+            auto const cached = _glyphCache->find(entry.glyphIndex);
+            renderGlyph(entry.glyphIndex, (cached != _glyphCache->end()) ? &cached->second : nullptr);
+        }
+    }
+    else
+    {
+        // Decoding runs ahead on its own thread, the queue bounds how many glyphs it keeps ready.
+        struct DecodedGlyph
+        {
+            uint32_t glyphIndex;
+            bool valid;
+            ttftk::Glyph glyph;
+        };
+
+        BoundedQueue<DecodedGlyph> decoded(64u);
+        std::thread decoder([&]()
+        {
+            for (ttftk::CharGlyphPair const& entry : glyphs)
+            {
+                DecodedGlyph item{};
+                item.glyphIndex = entry.glyphIndex;
+                item.valid = ttftk::ReadGlyphIndexData(_ttfFile, entry.glyphIndex, &item.glyph)
+                    == ttftk::Result::Success;
+                decoded.Push(std::move(item));
+            }
+            decoded.Close();
+        });
+
+        DecodedGlyph item{};
+        while (decoded.Pop(&item))
+            renderGlyph(item.glyphIndex, item.valid ? &item.glyph : nullptr);
+        decoder.join();
+    }
+
+    for (std::size_t cell = 0u; cell < cellCount; ++cell)
+    {
+        auto const it = firstCells.find(cellGlyphs[cell].glyphIndex);
+        if (it == firstCells.end() || it->second == cell)
+            continue;
+
+        for (uint32_t y = 0u; y < gridSizeY; ++y)
+        {
+            std::memcpy(cellPixels(cell) + y * header.width, cellPixels(it->second) + y * header.width,
+                        gridSizeX * sizeof(bmptk::PixelValue));
+        }
+    }
+}
+
+void PrintInstrumentationReport()
+{
+    ttftk::InstrumentationReport const report = ttftk::GetInstrumentationReport();
+    double const samples = (double)std::max<uint64_t>(report.windingEvals, 1u);
+
+    std::fprintf(stderr, "cmap lookups          %12llu\n", (unsigned long long)report.cmapLookups);
+    std::fprintf(stderr, "glyph decodes         %12llu\n", (unsigned long long)report.glyphDecodes);
+    std::fprintf(stderr, "composite recursions  %12llu\n", (unsigned long long)report.compositeRecursions);
+    std::fprintf(stderr, "winding evaluations   %12llu\n", (unsigned long long)report.windingEvals);
+    std::fprintf(stderr, "segments tested       %12llu  (%.1f per sample)\n",
+                 (unsigned long long)report.segmentTests, (double)report.segmentTests / samples);
+    std::fprintf(stderr, "spline intersections  %12llu  (%.1f per sample)\n",
+                 (unsigned long long)report.splineIntersections, (double)report.splineIntersections / samples);
+    std::fprintf(stderr, "distance evaluations  %12llu\n", (unsigned long long)report.distanceEvals);
+
+    char const* const stageNames[] = { "load", "decode", "rasterize", "encode" };
+    for (uint32_t stage = 0u; stage < (uint32_t)ttftk::Stage::Count; ++stage)
+    {
+        std::fprintf(stderr, "%-10s %8llu calls %12.3f ms\n", stageNames[stage],
+                     (unsigned long long)report.stageCalls[stage],
+                     (double)report.stageNanoseconds[stage] * 1e-6);
+    }
 }
 
 void RenderGlyph(ttftk::TrueTypeFile const& _ttfFile, ttftk::Glyph const& _glyph)
@@ -215,10 +1124,9 @@ void RenderGlyph(ttftk::TrueTypeFile const& _ttfFile, ttftk::Glyph const& _glyph
 void RenderGlyph(ttftk::TrueTypeFile const& _ttfFile, ttftk::Glyph const& _glyph,
                  bmptk::BitmapV1Header const& _header, bmptk::PixelValue *_pixels,
                  uint32_t xres, uint32_t yres, uint32_t xOffset, uint32_t yOffset,
-                 uint32_t samplingRate, float pixelSize, bool subPixelEval)
+                 uint32_t samplingRate, bool subPixelEval)
 {
-    int const maxX = (int)xres;
-    int const maxY = (int)yres;
+    TTFTK_SCOPED_TIMER(ttftk::Stage::Rasterize);
 
     float const sourceMaxX = (float)_ttfFile.xmax;
     float const sourceMinX = (float)_ttfFile.xmin;
@@ -233,60 +1141,51 @@ void RenderGlyph(ttftk::TrueTypeFile const& _ttfFile, ttftk::Glyph const& _glyph
         xaspect = 1.f;
     }
 
-    float const ssMaxX = (float)(maxX << samplingRate);
-    float const ssMaxY = (float)(maxY << samplingRate);
-    pixelSize /= (float)(1 << samplingRate);
+    // Cell pixels per font unit, the font bounding box is fit to the cell keeping its aspect.
+    float const scaleX = ((float)xres * xaspect) / (sourceMaxX - sourceMinX);
+    float const scaleY = ((float)yres * yaspect) / (sourceMaxY - sourceMinY);
+    float const cellTop = sourceMinY + (sourceMaxY - sourceMinY) / yaspect;
 
-    for (int y = 0; y < maxY; ++y)
-    {
-        for (int x = 0; x < maxX; ++x)
-        {
-            float accum = 0.f;
-            uint32_t sampleCount = (1 << (samplingRate*2));
-            for (uint32_t s = 0; s < sampleCount; ++s)
-            {
-                int sx = s & ((1 << samplingRate) - 1);
-                int sy = (s & (((1 << samplingRate) - 1) << samplingRate)) >> samplingRate;
+    ttftk::GlyphOutline outline{};
+    ttftk::TransformGlyph(&_glyph, scaleX, scaleY,
+                          -sourceMinX * scaleX, (float)yres - cellTop * scaleY, &outline);
 
-                float u = (((float)((x << samplingRate) + sx) + 0.5f) / ssMaxX) / xaspect;
-                float v = (1.f - ((float)((y << samplingRate) + sy) + 0.5f) / ssMaxY) / yaspect;
+    std::vector<uint8_t> coverage(xres * yres);
+    ttftk::RasterSurface surface{};
+    surface.pixels = coverage.data();
+    surface.width = xres;
+    surface.height = yres;
+    surface.stride = xres;
+    ttftk::RasterizeOutline(&outline, samplingRate, subPixelEval, surface);
 
-                int16_t sampleX = (int16_t)std::round(u * (sourceMaxX - sourceMinX) + sourceMinX);
-                int16_t sampleY = (int16_t)std::round(v * (sourceMaxY - sourceMinY) + sourceMinY);
-
-                float coverage = 0.f;
-                float distance = pixelSize*0.5f;
-                int32_t windingNumber =
-                    ttftk::EvalWindingNumber(&_glyph, sampleX, sampleY,
-                                             (subPixelEval ? &distance : nullptr));
-
-                if (windingNumber > 0)
-                    coverage = 1.f-std::max(0.5f-(std::abs(distance)/pixelSize), 0.f);
-                else if (std::abs(distance) < pixelSize*0.5f)
-                    coverage = std::max(0.5f-(std::abs(distance) / pixelSize), 0.f);
-
-                accum += (255.f * coverage) / sampleCount;
+    CompositeWhite(coverage.data(), xres, yres, _header, _pixels, xOffset, yOffset);
+}
 
-#if 0
-                if (windingNumber > 0)
-                    accum += 255.f / sampleCount;
-#if 0
-                else
-                {
-                    float distance = ttftk::EvalDistance(&_glyph, sampleX, sampleY);
-                    if (distance < 300.f)
-                        accum += 0.f / sampleCount;
-                    else
-                        accum += 0.f / sampleCount;
-                }
-#else
-                else accum += 0.f / sampleCount;
-#endif
-#endif
+void CompositeWhite(uint8_t const* _coverage, uint32_t _width, uint32_t _height,
+                    bmptk::BitmapV1Header const& _header, bmptk::PixelValue* _pixels,
+                    uint32_t _x, uint32_t _y)
+{
+    // Packed three channel pixels are blended in place, over black this writes the coverage as gray.
+    if constexpr (sizeof(bmptk::PixelValue) == 3u)
+    {
+        ttftk::ColorSurface surface{};
+        surface.pixels = (uint8_t*)_pixels;
+        surface.width = (uint32_t)_header.width;
+        surface.height = (uint32_t)std::abs(_header.height);
+        surface.stride = surface.width * 3u;
+        surface.format = ttftk::PixelFormat::RGB8;
+        ttftk::CompositeCoverage(_coverage, _width, _height, _width, surface, (int32_t)_x, (int32_t)_y,
+                                 ttftk::Color{ 255u, 255u, 255u, 255u });
+    }
+    else
+    {
+        for (uint32_t y = 0; y < _height; ++y)
+        {
+            for (uint32_t x = 0; x < _width; ++x)
+            {
+                bmptk::PixelValue* pixel = _pixels + ((_x + x) + (_y + y)*_header.width);
+                pixel->d[0] = pixel->d[1] = pixel->d[2] = _coverage[x + y * _width];
             }
-
-            bmptk::PixelValue* pixel = _pixels + ((xOffset + x) + (yOffset + y)*_header.width);
-            pixel->d[0] = pixel->d[1] = pixel->d[2] = (float)std::round(accum);
         }
     }
 }
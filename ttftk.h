@@ -1,8 +1,15 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <limits>
 #include <vector>
 
+#ifdef TTFTK_INSTRUMENTATION
+#include <atomic>
+#include <chrono>
+#endif
+
 namespace ttftk
 {
 
@@ -14,6 +21,11 @@ enum class Result
     UnknownCMAPTable,
     UnknownCMAPFormat,
     GlyphMissing,
+    InvalidCompiledFont,
+    StaleCompiledFont,
+    FaceMissing,
+    AtlasFull,
+    Cancelled,
 };
 
 struct OffsetSubtable
@@ -52,6 +64,11 @@ struct TrueTypeFile
     std::vector<TableDirectoryEntry> tableDirectory;
     int16_t xmin, ymin, xmax, ymax;
     int16_t emsize;
+    int16_t indexToLocFormat;
+    uint16_t glyphCount;
+    int16_t ascent, descent, lineGap;
+    uint16_t advanceWidthMax;
+    uint16_t hmetricCount;
 };
 
 struct GlyphPoints
@@ -76,12 +93,513 @@ struct Glyph
     std::vector<GlyphContour> contours;
 };
 
-Result LoadTTF(uint8_t const* _memory, TrueTypeFile* _ttfFile);
+// Glyph outline scaled and translated once into pixel space (y up), same on/off/.../on
+// layout as GlyphContour. contourEnds holds one past the last point of each contour.
+struct GlyphOutline
+{
+    float xmin, ymin, xmax, ymax;
+    std::vector<float> x{};
+    std::vector<float> y{};
+    std::vector<uint32_t> contourEnds{};
+};
+
+struct GlyphMetrics
+{
+    uint16_t advanceWidth;
+    int16_t leftSideBearing;
+};
+
+// u and v are in halves, (0, 0), (1, 0), (2, 2) on curve triangles and (0, 2) on interior ones.
+struct MeshVertex
+{
+    int16_t x, y;
+    uint8_t u, v;
+};
+
+// Triangles of a glyph outline in font units, for resolution independent rendering. Each contour is
+// a fan of its chords from its first point, followed by one Loop-Blinn triangle per curved segment
+// covering u^2 - v < 0. Triangles are not disjoint: a sample is inside when the sum over the
+// triangles covering it, +1 for clockwise and -1 for counter clockwise ones, is positive (e.g. with
+// stencil increments and decrements). Curve triangles start at curveIndexOffset.
+struct GlyphMesh
+{
+    int16_t xmin, ymin, xmax, ymax;
+    std::vector<MeshVertex> vertices{};
+    std::vector<uint32_t> indices{};
+    uint32_t curveIndexOffset;
+};
+
+// Meshes built on first use, one slot per glyph index.
+struct GlyphMeshCache
+{
+    TrueTypeFile const* ttfFile;
+    std::vector<GlyphMesh> meshes{};
+    std::vector<uint8_t> built{};
+};
+
+// Point in font units.
+struct GlyphPoint
+{
+    int16_t x, y;
+};
+
+struct CharGlyphPair
+{
+    uint32_t charCode;
+    uint32_t glyphIndex;
+};
+
+// One glyph of a laid out run. penX is in font units from the run origin,
+// uniqueIndex points into TextRun::glyphIndices.
+struct GlyphPlacement
+{
+    uint32_t charCode;
+    uint32_t glyphIndex;
+    uint32_t uniqueIndex;
+    int32_t penX;
+    GlyphMetrics metrics;
+};
+
+struct TextRun
+{
+    std::vector<uint32_t> glyphIndices{};
+    std::vector<GlyphPlacement> placements{};
+    int32_t advance;
+};
+
+static constexpr uint32_t kCoveragePageCount = 0x110000u >> 8;
+static constexpr uint16_t kCoverageNoPage = 0xFFFFu;
+static constexpr uint32_t kRegistryNoFont = 0xFFFFFFFFu;
+
+// Code points a font maps to a glyph other than .notdef, in pages of 256 codes. pageBlocks holds per
+// page the first of its four 64 bit words in bits, kCoverageNoPage for pages without any code.
+// glyphs holds the glyph of every code of those pages, a page's 256 entries start at its block * 64.
+struct FontCoverage
+{
+    std::vector<uint16_t> pageBlocks{};
+    std::vector<uint64_t> bits{};
+    std::vector<uint16_t> glyphs{};
+};
+
+// Fonts tried in order for each code point. For every page covered by one of them, codeFonts holds
+// per code point the position in fonts of the first one covering it (0xFF for none) and codeGlyphs
+// its glyph. pageSlots gives the page's offset in both in units of 256.
+struct FallbackChain
+{
+    std::vector<uint32_t> fonts{};
+    std::vector<uint16_t> pageSlots{};
+    std::vector<uint8_t> codeFonts{};
+    std::vector<uint16_t> codeGlyphs{};
+};
+
+struct FontRegistry
+{
+    std::vector<TrueTypeFile const*> fonts{};
+    std::vector<FontCoverage> coverage{};
+    std::vector<FallbackChain> chains{};
+};
+
+// Consecutive code points drawn with the same registry font, [begin, end) indexes the code points and
+// the glyph indices of the resolve call.
+struct FontRun
+{
+    uint32_t font;
+    uint32_t begin, end;
+};
+
+// 8bit coverage of a single glyph, left/top are the pixel offsets of the
+// bitmap's top left corner relative to the glyph origin (y up).
+struct CoverageBitmap
+{
+    int32_t left, top;
+    uint32_t width, height;
+    std::vector<uint8_t> pixels{};
+};
+
+// Simplified copies of a glyph for small pixel sizes. levels[i] stays within tolerances[i] font units
+// of the full outline, tolerances double from one level to the next.
+struct GlyphLevels
+{
+    Glyph full{};
+    std::vector<Glyph> levels{};
+    std::vector<float> tolerances{};
+};
+
+// Coverage difference against a reference render, 1 is a full pixel.
+struct CoverageError
+{
+    float mean;
+    float max;
+};
+
+struct RasterSurface
+{
+    uint8_t* pixels;
+    uint32_t width, height;
+    uint32_t stride;
+};
+
+// Compiled fonts are a single blob in native byte order whose sections are addressed by offsets from
+// its start, so a blob written by CompileFont can be mapped at any address and used in place.
+// Sections are 4 byte aligned. The blob is rejected when the magic (e.g. other byte order) or the
+// version differ, and IsCompiledFrom checks it against the TrueType file it was built from.
+static constexpr uint32_t kCompiledFontMagic = 0x43465454u; // "TTFC"
+static constexpr uint32_t kCompiledFontVersion = 1u;
+
+struct CompiledFontHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t payloadHash; // FNV-1a of the bytes past the header
+    uint32_t sourceChecksum; // head.checkSumAdjustment
+    uint32_t sourceModified[2]; // head.modified
+    int16_t xmin, ymin, xmax, ymax;
+    int16_t emsize;
+    int16_t ascent, descent, lineGap;
+    uint16_t advanceWidthMax;
+    uint16_t glyphCount;
+    uint32_t charRangeCount, charRangeOffset;
+    uint32_t glyphOffset;
+    uint32_t contourEndCount, contourEndOffset;
+    uint32_t pointCount, pointXOffset, pointYOffset;
+};
+
+// Runs of consecutive character codes mapped to consecutive glyphs, sorted by code.
+struct CompiledCharRange
+{
+    uint32_t firstCode, lastCode;
+    int32_t glyphDelta;
+};
+
+// Contours use the GlyphContour on/off/.../on layout, contour ends index the shared point arrays.
+struct CompiledGlyph
+{
+    int16_t xmin, ymin, xmax, ymax;
+    uint16_t advanceWidth;
+    int16_t leftSideBearing;
+    uint32_t firstContour, contourCount;
+};
+
+// View into a compiled font blob, the blob must outlive it.
+struct CompiledFont
+{
+    CompiledFontHeader const* header;
+    CompiledCharRange const* charRanges;
+    CompiledGlyph const* glyphs;
+    uint32_t const* contourEnds;
+    int16_t const* pointX;
+    int16_t const* pointY;
+};
+
+// Faces of a TrueType collection all reference the collection's memory.
+struct FontCollection
+{
+    std::vector<TrueTypeFile> faces{};
+};
+
+// Compiled faces of a collection, built in memory. Faces whose glyf and loca tables sit at the same
+// offset share their points, faces with the same cmap offset share their character ranges.
+// Headers have no section offsets, the views point into the shared sections.
+struct CompiledCollection
+{
+    std::vector<CompiledFontHeader> headers{};
+    std::vector<CompiledFont> faces{};
+    std::vector<std::vector<CompiledCharRange>> charRanges{};
+    std::vector<std::vector<CompiledGlyph>> glyphs{};
+    std::vector<std::vector<uint32_t>> contourEnds{};
+    std::vector<std::vector<int16_t>> pointX{};
+    std::vector<std::vector<int16_t>> pointY{};
+};
+
+// Buffers reused across RenderTextRun calls.
+struct RenderScratch
+{
+    std::vector<Glyph> glyphs{};
+    std::vector<CoverageBitmap> bitmaps{};
+};
+
+enum class PixelFormat
+{
+    Gray8,
+    RGB8,
+    RGBA8,
+};
+
+// Target of CompositeCoverage, channels are stored in the order of the format name. stride is in
+// bytes and rows are stored top to bottom.
+struct ColorSurface
+{
+    uint8_t* pixels;
+    uint32_t width, height;
+    uint32_t stride;
+    PixelFormat format;
+};
+
+struct Color
+{
+    uint8_t r, g, b, a;
+};
+
+struct AtlasRect
+{
+    uint32_t x, y, width, height;
+};
+
+// A glyph cached in a GlyphAtlas. rect holds the coverage, left/top as in CoverageBitmap, slot is the
+// space reserved for it including a one pixel gutter. Empty glyphs have zero sized rects.
+struct AtlasEntry
+{
+    uint32_t glyphIndex;
+    AtlasRect rect;
+    AtlasRect slot;
+    int32_t left, top;
+    uint64_t lastUse;
+};
+
+struct AtlasShelf
+{
+    uint32_t y, height, usedWidth;
+};
+
+static constexpr uint32_t kAtlasNoEntry = 0xFFFFFFFFu;
+
+// Pixel sharing of an atlas entry. Glyphs rendering to the same coverage as a cached one point at its
+// pixels, owner is the entry holding them and users counts the entries using an owner's pixels. An
+// evicted owner keeps its slot until its last user is evicted. Owners with pixels are chained per
+// coverage hash bucket.
+struct AtlasShare
+{
+    uint32_t owner;
+    uint32_t users;
+    uint32_t hash;
+    uint32_t nextOwner;
+};
+
+// Coverage atlas filled on demand at a single pixel size. Glyphs are packed on shelves, evicted
+// slots are reused by glyphs that fit them and the atlas compacts once neither has room. Each glyph
+// index is rendered once and identical renders of different glyphs share their pixels.
+// dirtyRects collects the regions written since the caller last cleared it. Compaction moves
+// glyphs and increments generation, rects acquired before must then be acquired again.
+struct GlyphAtlas
+{
+    TrueTypeFile const* ttfFile;
+    float pixelSize;
+    uint32_t samplingRate;
+    bool subPixelEval;
+    uint32_t width, height;
+    uint32_t generation;
+    uint64_t frame;
+    std::vector<uint8_t> pixels{};
+    std::vector<AtlasEntry> entries{};
+    std::vector<uint32_t> glyphEntries{}; // entry per glyph index, kAtlasNoEntry when not cached
+    std::vector<uint32_t> freeEntries{}; // evicted entries whose slot can be reused
+    std::vector<AtlasShare> shares{}; // per entry
+    std::vector<uint32_t> shareBuckets{}; // first owner per coverage hash bucket
+    std::vector<AtlasShelf> shelves{};
+    std::vector<AtlasRect> dirtyRects{};
+    Glyph glyph{};
+    CoverageBitmap bitmap{};
+};
+
+// kern table compiled for constant time pair lookups. Format 0 pairs are stored in an open
+// addressing hash keyed on (left << 16 | right), format 2 subtables as dense class matrices.
+struct KerningClassMatrix
+{
+    uint16_t firstLeft, firstRight;
+    uint16_t columnCount;
+    std::vector<uint16_t> leftRows{};
+    std::vector<uint16_t> rightColumns{};
+    std::vector<int16_t> values{};
+};
+
+struct KerningTable
+{
+    uint32_t pairMask;
+    std::vector<uint32_t> pairKeys{};
+    std::vector<int16_t> pairValues{};
+    std::vector<KerningClassMatrix> classMatrices{};
+};
+
+// A glyph render handled by a RenderService, the service keeps the pointer to ttfFile. Requests
+// equal in all fields are coalesced while in flight.
+struct RenderRequest
+{
+    TrueTypeFile const* ttfFile;
+    uint32_t glyphIndex;
+    float pixelSize;
+    uint32_t samplingRate;
+    bool subPixelEval;
+};
+
+// Called on a worker thread once a render finished, _bitmap is only valid during the call.
+using RenderCallback = void (*)(void* _user, uint64_t _ticket, Result _result, CoverageBitmap const& _bitmap);
+
+struct RenderService;
+
+// _faceIndex selects a face of a TrueType collection (ttcf), plain files only have face 0.
+Result LoadTTF(uint8_t const* _memory, TrueTypeFile* _ttfFile, uint32_t _faceIndex = 0u);
+// Face count of a collection, 1 for a plain TrueType file and 0 for unknown data.
+uint32_t GetFaceCount(uint8_t const* _memory);
+Result LoadCollection(uint8_t const* _memory, FontCollection* _collection);
 Result ReadGlyphData(TrueTypeFile const& _ttfFile, uint32_t _characterCode, Glyph* _glyph);
+Result ReadGlyphIndexData(TrueTypeFile const& _ttfFile, uint32_t _glyphIndex, Glyph* _glyph);
+uint32_t GetGlyphIndex(TrueTypeFile const& _ttfFile, uint32_t _characterCode);
+GlyphMetrics GetGlyphMetrics(TrueTypeFile const& _ttfFile, uint32_t _glyphIndex);
 std::vector<uint32_t> ListCharCodes(TrueTypeFile const& _ttfFile);
+// One pair per distinct glyph, ordered by glyph data offset so that decoding in order reads glyf
+// sequentially. Each glyph is paired with the lowest character code mapping to it, codes without
+// glyph share glyph 0. The first overload covers every character code of the cmap.
+std::vector<CharGlyphPair> ListGlyphsInFileOrder(TrueTypeFile const& _ttfFile);
+std::vector<CharGlyphPair> ListGlyphsInFileOrder(TrueTypeFile const& _ttfFile, uint32_t const* _charCodes,
+                                                 size_t _count);
+// Same ordering for pairs whose glyphs are already resolved, _glyphs is reduced to one pair per glyph.
+void SortGlyphsInFileOrder(TrueTypeFile const& _ttfFile, std::vector<CharGlyphPair>* _glyphs);
 
 int32_t EvalWindingNumber(Glyph const* _glyph, int16_t _sampleX, int16_t _sampleY, float* _distance);
 float EvalDistance(Glyph const* _glyph, int16_t _sampleX, int16_t _sampleY);
+// Same classification as EvalWindingNumber(...) > 0 for a batch of points. Points are sorted by y and
+// each segment only tests the points within its vertical extent, so the cost follows the point count
+// times the segments crossed by a horizontal line instead of every segment. _inside[i] is 1 inside.
+// With _distances, _distances[i] receives EvalDistance negated inside, for the segments whose bounds
+// are within _maxDistance of the point. Points further from every segment get +/-_maxDistance; the
+// default tests every segment, matching EvalDistance.
+void ClassifyPoints(Glyph const* _glyph, GlyphPoint const* _points, size_t _count, uint8_t* _inside,
+                    float* _distances = nullptr,
+                    float _maxDistance = std::numeric_limits<float>::infinity());
+
+// outline = glyph * scale + offset
+void TransformGlyph(Glyph const* _glyph, float _scaleX, float _scaleY, float _offsetX, float _offsetY,
+                    GlyphOutline* _outline);
+int32_t EvalWindingNumber(GlyphOutline const* _outline, float _sampleX, float _sampleY, float* _distance);
+float EvalDistance(GlyphOutline const* _outline, float _sampleX, float _sampleY);
+
+// Only horizontal, non cross-stream subtables are compiled. Fonts without kern table
+// produce an empty table for which GetKerning always returns 0.
+Result CompileKerning(TrueTypeFile const& _ttfFile, KerningTable* _kerning);
+int16_t GetKerning(KerningTable const& _kerning, uint32_t _left, uint32_t _right);
+// _adjustments[i] receives the kerning between glyphs i and i+1, the last entry is 0.
+void GetKerning(KerningTable const& _kerning, uint32_t const* _glyphIndices, size_t _count,
+                int16_t* _adjustments);
+
+void BuildFontCoverage(TrueTypeFile const& _ttfFile, FontCoverage* _coverage);
+bool IsCovered(FontCoverage const& _coverage, uint32_t _charCode);
+// The registry keeps a pointer to _ttfFile and builds its coverage. Returns the font's registry index.
+uint32_t RegisterFont(FontRegistry* _registry, TrueTypeFile const& _ttfFile);
+// _fonts are registry indices in fallback order, at most 255 of them. Returns the chain's index.
+uint32_t CreateFallbackChain(FontRegistry* _registry, uint32_t const* _fonts, size_t _count);
+// First font of the chain covering the code point, kRegistryNoFont when none does.
+uint32_t FindCoveringFont(FontRegistry const& _registry, uint32_t _chain, uint32_t _charCode,
+                          uint32_t* _glyphIndex = nullptr);
+// Splits the code points into runs of the same font in one pass. Code points no font of the chain
+// covers get glyph 0 of the current run's font, the chain's first font at the start.
+void ResolveFontRuns(FontRegistry const& _registry, uint32_t _chain, uint32_t const* _charCodes, size_t _count,
+                     std::vector<FontRun>* _runs, std::vector<uint32_t>* _glyphIndices);
+
+// Missing characters are laid out with glyph 0 (.notdef).
+Result LayoutText(TrueTypeFile const& _ttfFile, uint32_t const* _charCodes, size_t _count,
+                  TextRun* _run, KerningTable const* _kerning = nullptr);
+void RasterizeGlyph(Glyph const* _glyph, float _pixelSize, uint32_t _samplingRate, bool _subPixelEval,
+                    CoverageBitmap* _bitmap);
+// Same as RasterizeGlyph for each pixel size, the outline buffers and segment bounds are set up once
+// and rescaled per size. With _mipCount > 0, _mips receives that many successive halvings of the
+// largest bitmap (smallest pixel size).
+void RasterizeGlyphSizes(Glyph const* _glyph, float const* _pixelSizes, size_t _sizeCount,
+                         uint32_t _samplingRate, bool _subPixelEval, CoverageBitmap* _bitmaps,
+                         uint32_t _mipCount = 0u, CoverageBitmap* _mips = nullptr);
+// 2x2 box filter on the pixel grid of the glyph origin, so left/top of the result are halved too.
+void DownsampleCoverage(CoverageBitmap const& _source, CoverageBitmap* _target);
+// Merges runs of segments that a single quadratic or line follows within _tolerance font units, both
+// ways. Every contour keeps its direction and at least two segments, the bounding box is kept so that
+// renders line up with the full outline.
+void SimplifyGlyph(Glyph const* _glyph, float _tolerance, Glyph* _simplified);
+void BuildGlyphLevels(Glyph const* _glyph, float _tolerance, uint32_t _levelCount, GlyphLevels* _levels);
+// Coarsest level whose tolerance is at most _pixelTolerance pixels, the full outline when none is.
+Glyph const* SelectGlyphLevel(GlyphLevels const& _levels, float _pixelSize, float _pixelTolerance = 0.125f);
+// Pixels outside of one bitmap count as empty, the mean is over the union of both.
+CoverageError MeasureCoverageError(CoverageBitmap const& _reference, CoverageBitmap const& _bitmap);
+// Overwrites the surface with the coverage of an outline spanning [0, width]x[0, height] in pixel
+// space, surface rows are stored top to bottom.
+void RasterizeOutline(GlyphOutline const* _outline, uint32_t _samplingRate, bool _subPixelEval,
+                      RasterSurface const& _surface);
+// Runtime sampling rate path that takes every sample of every pixel. RasterizeOutline uses
+// specialized kernels for rates 0 to 3 and only supersamples pixels near an edge.
+void RasterizeOutlineGeneric(GlyphOutline const* _outline, uint32_t _samplingRate, bool _subPixelEval,
+                             RasterSurface const& _surface);
+// Glyphs that cannot be decoded are stored without contours.
+Result CompileFont(TrueTypeFile const& _ttfFile, std::vector<uint8_t>* _blob);
+// Only the header and section bounds are checked unless _verifyPayload is set, which hashes the blob.
+Result OpenCompiledFont(void const* _memory, size_t _size, CompiledFont* _font, bool _verifyPayload = false);
+bool IsCompiledFrom(CompiledFont const& _font, TrueTypeFile const& _ttfFile);
+uint32_t GetGlyphIndex(CompiledFont const& _font, uint32_t _characterCode);
+GlyphMetrics GetGlyphMetrics(CompiledFont const& _font, uint32_t _glyphIndex);
+Result ReadGlyphIndexData(CompiledFont const& _font, uint32_t _glyphIndex, Glyph* _glyph);
+// Same as TransformGlyph on the decoded glyph, straight from the compiled points.
+void TransformGlyph(CompiledFont const& _font, uint32_t _glyphIndex, float _scaleX, float _scaleY,
+                    float _offsetX, float _offsetY, GlyphOutline* _outline);
+Result CompileCollection(FontCollection const& _collection, CompiledCollection* _compiled);
+// Writes a TrueType file with the glyphs of _charCodes, the components of their composite glyphs and
+// glyph 0, in their original order. glyf, loca, cmap (format 4, plus 12 past the BMP), hmtx, hhea,
+// maxp, head and post (as version 3) are rebuilt, name, OS/2, gasp and the hinting tables copied.
+// kern is flattened to format 0 pairs between the kept glyphs. Other tables that index glyphs
+// (hdmx, layout tables) are dropped.
+Result SubsetFont(TrueTypeFile const& _ttfFile, uint32_t const* _charCodes, size_t _count,
+                  std::vector<uint8_t>* _output);
+
+// Each unique glyph of the run is decoded and rasterized once, pen positions are snapped
+// to whole pixels. (_originX, _baselineY) is in surface pixels, coverage is added saturated.
+Result RenderTextRun(TrueTypeFile const& _ttfFile, TextRun const& _run,
+                     float _pixelSize, uint32_t _samplingRate, bool _subPixelEval,
+                     RasterSurface const& _surface, int32_t _originX, int32_t _baselineY,
+                     RenderScratch* _scratch);
+
+void BuildGlyphMesh(Glyph const* _glyph, GlyphMesh* _mesh);
+// The cache keeps a pointer to _ttfFile.
+void CreateGlyphMeshCache(TrueTypeFile const& _ttfFile, GlyphMeshCache* _cache);
+// The mesh stays valid as long as the cache.
+Result GetGlyphMesh(GlyphMeshCache* _cache, uint32_t _glyphIndex, GlyphMesh const** _mesh);
+// CPU reference for the mesh, laid out and sampled like RasterizeGlyph without subpixel evaluation.
+void RasterizeGlyphMesh(GlyphMesh const& _mesh, float _pixelSize, uint32_t _samplingRate,
+                        CoverageBitmap* _bitmap);
+
+// Blends coverage into the surface with (_x, _y) as the top left corner, clipped to the surface:
+// target += (color - target) * coverage * color.a, with every product rounded to 8 bits.
+// RGBA targets blend their alpha toward 255, gray targets toward the luma of the color.
+void CompositeCoverage(uint8_t const* _coverage, uint32_t _width, uint32_t _height, uint32_t _stride,
+                       ColorSurface const& _surface, int32_t _x, int32_t _y, Color _color);
+void CompositeCoverage(CoverageBitmap const& _bitmap, ColorSurface const& _surface, int32_t _x, int32_t _y,
+                       Color _color);
+
+// The atlas keeps a pointer to _ttfFile, rows of pixels are stored top to bottom.
+void CreateGlyphAtlas(TrueTypeFile const& _ttfFile, float _pixelSize, uint32_t _samplingRate,
+                      bool _subPixelEval, uint32_t _width, uint32_t _height, GlyphAtlas* _atlas);
+// Glyphs acquired during the current frame are never evicted.
+void BeginAtlasFrame(GlyphAtlas* _atlas);
+// Returns the cached entry, or rasterizes the glyph into free space. When the atlas has no room the
+// glyphs unused in the current frame are evicted and the atlas is compacted before giving up.
+Result AcquireGlyph(GlyphAtlas* _atlas, uint32_t _glyphIndex, AtlasEntry* _entry);
+// Frees the glyphs not used during the last _maxAge frames and returns how many were evicted.
+size_t EvictGlyphs(GlyphAtlas* _atlas, uint64_t _maxAge);
+// Repacks the cached glyphs by height and drops the free slots, the whole atlas becomes dirty.
+void CompactGlyphAtlas(GlyphAtlas* _atlas);
+
+// Worker pool rendering RenderRequests by priority, higher priorities are always started first and
+// equal priorities in submission order. Destroying the service drops the queued renders and waits
+// for the running ones, no WaitRender may be pending then.
+RenderService* CreateRenderService(uint32_t _threadCount);
+void DestroyRenderService(RenderService* _service);
+// Returns the ticket of the render. Without a callback the ticket is held until WaitRender returns
+// its result or it is cancelled. Submitting a request already in flight shares its render and
+// raises its priority to _priority if that is higher.
+uint64_t SubmitRender(RenderService* _service, RenderRequest const& _request, uint32_t _priority,
+                      RenderCallback _callback = nullptr, void* _user = nullptr);
+// Releases the ticket, a render whose tickets were all cancelled before it started is dropped.
+// Returns false when the ticket is unknown or its render already finished.
+bool CancelRender(RenderService* _service, uint64_t _ticket);
+// Copies the finished render to _bitmap and releases the ticket. Returns Incomplete without
+// blocking when _block is false and the render is still pending, Cancelled for unknown tickets and
+// tickets with a callback.
+Result WaitRender(RenderService* _service, uint64_t _ticket, CoverageBitmap* _bitmap, bool _block = true);
 
 template <typename T>
 static inline void const* AdvancePointer(void const* _source, size_t _count = 1)
@@ -151,16 +669,162 @@ static inline float F2Dot14(int16_t _v) {
 #define CompareTag(t, s) (t[3]==s[0]) && (t[2]==s[1]) && (t[1]==s[2]) && (t[0]==s[3])
 #define CompareTagU32(t, s) CompareTag(((char const*)&t), s)
 
+// Hot path counters and per stage timers, compiled out unless TTFTK_INSTRUMENTATION is defined.
+// Counters are process wide and updated with relaxed atomics.
+enum class Stage : uint32_t
+{
+    Load,
+    Decode,
+    Rasterize,
+    Encode,
+    Count,
+};
+
+struct InstrumentationReport
+{
+    uint64_t cmapLookups;
+    uint64_t glyphDecodes;
+    uint64_t compositeRecursions;
+    uint64_t windingEvals;
+    uint64_t segmentTests;
+    uint64_t splineIntersections;
+    uint64_t distanceEvals;
+    uint64_t stageCalls[(uint32_t)Stage::Count];
+    uint64_t stageNanoseconds[(uint32_t)Stage::Count];
+};
+
+#ifdef TTFTK_INSTRUMENTATION
+
+struct Instrumentation
+{
+    std::atomic<uint64_t> cmapLookups;
+    std::atomic<uint64_t> glyphDecodes;
+    std::atomic<uint64_t> compositeRecursions;
+    std::atomic<uint64_t> windingEvals;
+    std::atomic<uint64_t> segmentTests;
+    std::atomic<uint64_t> splineIntersections;
+    std::atomic<uint64_t> distanceEvals;
+    std::atomic<uint64_t> stageCalls[(uint32_t)Stage::Count];
+    std::atomic<uint64_t> stageNanoseconds[(uint32_t)Stage::Count];
+};
+
+extern Instrumentation gInstrumentation;
+
+class ScopedStageTimer
+{
+public:
+    explicit ScopedStageTimer(Stage _stage)
+        : stage_((uint32_t)_stage), begin_(std::chrono::steady_clock::now())
+    {}
+    ~ScopedStageTimer()
+    {
+        auto const elapsed = std::chrono::steady_clock::now() - begin_;
+        gInstrumentation.stageCalls[stage_].fetch_add(1u, std::memory_order_relaxed);
+        gInstrumentation.stageNanoseconds[stage_].fetch_add(
+            (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+            std::memory_order_relaxed);
+    }
+
+private:
+    uint32_t stage_;
+    std::chrono::steady_clock::time_point begin_;
+};
+
+#define TTFTK_COUNT(counter, n) \
+    ::ttftk::gInstrumentation.counter.fetch_add((uint64_t)(n), std::memory_order_relaxed)
+#define TTFTK_TIMER_CAT2(a, b) a##b
+#define TTFTK_TIMER_CAT(a, b) TTFTK_TIMER_CAT2(a, b)
+#define TTFTK_SCOPED_TIMER(stage) \
+    ::ttftk::ScopedStageTimer TTFTK_TIMER_CAT(ttftkStageTimer, __LINE__)(stage)
+
+#else
+
+#define TTFTK_COUNT(counter, n) ((void)0)
+#define TTFTK_SCOPED_TIMER(stage) ((void)0)
+
+#endif
+
+// Both are no-ops returning zeroes when instrumentation is compiled out.
+InstrumentationReport GetInstrumentationReport();
+void ResetInstrumentation();
+
 } // namespace ttftk
 
 #ifdef TTFTK_IMPLEMENTATION
 
 #include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+// SSSE3 byte shuffles gather the glyf coordinate deltas, define TTFTK_NO_SIMD to force the scalar path.
+#if !defined(TTFTK_NO_SIMD) && (defined(__SSSE3__) || defined(__AVX__))
+#define TTFTK_SSSE3
+#include <tmmintrin.h>
+#endif
+
+// Coverage compositing blends 16 bytes per step with SSE2 and 32 with AVX2.
+#if !defined(TTFTK_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define TTFTK_SSE2
+#include <emmintrin.h>
+#endif
+#if !defined(TTFTK_NO_SIMD) && defined(__AVX2__)
+#define TTFTK_AVX2
+#include <immintrin.h>
+#endif
 
 namespace ttftk
 {
 
+#ifdef TTFTK_INSTRUMENTATION
+Instrumentation gInstrumentation{};
+#endif
+
+InstrumentationReport GetInstrumentationReport()
+{
+    InstrumentationReport report{};
+#ifdef TTFTK_INSTRUMENTATION
+    report.cmapLookups = gInstrumentation.cmapLookups.load(std::memory_order_relaxed);
+    report.glyphDecodes = gInstrumentation.glyphDecodes.load(std::memory_order_relaxed);
+    report.compositeRecursions = gInstrumentation.compositeRecursions.load(std::memory_order_relaxed);
+    report.windingEvals = gInstrumentation.windingEvals.load(std::memory_order_relaxed);
+    report.segmentTests = gInstrumentation.segmentTests.load(std::memory_order_relaxed);
+    report.splineIntersections = gInstrumentation.splineIntersections.load(std::memory_order_relaxed);
+    report.distanceEvals = gInstrumentation.distanceEvals.load(std::memory_order_relaxed);
+    for (uint32_t stage = 0u; stage < (uint32_t)Stage::Count; ++stage)
+    {
+        report.stageCalls[stage] = gInstrumentation.stageCalls[stage].load(std::memory_order_relaxed);
+        report.stageNanoseconds[stage] = gInstrumentation.stageNanoseconds[stage].load(std::memory_order_relaxed);
+    }
+#endif
+    return report;
+}
+
+void ResetInstrumentation()
+{
+#ifdef TTFTK_INSTRUMENTATION
+    gInstrumentation.cmapLookups.store(0u, std::memory_order_relaxed);
+    gInstrumentation.glyphDecodes.store(0u, std::memory_order_relaxed);
+    gInstrumentation.compositeRecursions.store(0u, std::memory_order_relaxed);
+    gInstrumentation.windingEvals.store(0u, std::memory_order_relaxed);
+    gInstrumentation.segmentTests.store(0u, std::memory_order_relaxed);
+    gInstrumentation.splineIntersections.store(0u, std::memory_order_relaxed);
+    gInstrumentation.distanceEvals.store(0u, std::memory_order_relaxed);
+    for (uint32_t stage = 0u; stage < (uint32_t)Stage::Count; ++stage)
+    {
+        gInstrumentation.stageCalls[stage].store(0u, std::memory_order_relaxed);
+        gInstrumentation.stageNanoseconds[stage].store(0u, std::memory_order_relaxed);
+    }
+#endif
+}
+
 void const* ExtractOffsetSubtable(void const* _ptr, OffsetSubtable& _output);
 void const* ExtractTableDirectory(void const* _ptr, uint16_t _count, TableDirectoryEntry* _output);
 uint32_t ExtractGlyphIndex(void const* _ptr, uint16_t _format, uint32_t _charCode);
@@ -169,15 +833,48 @@ GlyphPoints ExtractGlyphPoints(uint8_t const* _loca,
                                uint16_t _indexToLocFormat,
                                uint32_t _glyphIndex);
 
-uint16_t IntersectSpline(int16_t const _pointTraceAxis[3], int16_t const _pointCrossAxis[3],
+uint16_t IntersectSpline(float const _pointTraceAxis[3], float const _pointCrossAxis[3],
                          float* _c0, float* _c1);
+uint16_t CrossSplineExact(int32_t const _pointTraceAxis[3], int32_t const _pointCrossAxis[3]);
+static uint32_t HashBytes(uint8_t const* _bytes, size_t _size);
+
+static constexpr uint32_t kCollectionTag = 0x74746366u; // "ttcf"
+
+uint32_t GetFaceCount(uint8_t const* _memory)
+{
+    void const* ptr = (void const*)_memory;
+    uint32_t const scalerType = ReadU32(ptr);
+    if (scalerType == 0x00010000 || scalerType == 0x74727565)
+        return 1u;
+    if (scalerType != kCollectionTag)
+        return 0u;
+
+    ReadU32(ptr); // version
+    return ReadU32(ptr);
+}
 
-Result LoadTTF(uint8_t const* _memory, TrueTypeFile* _ttfFile)
+Result LoadTTF(uint8_t const* _memory, TrueTypeFile* _ttfFile, uint32_t _faceIndex)
 {
+    TTFTK_SCOPED_TIMER(Stage::Load);
+
     TrueTypeFile ttfFile{};
     ttfFile.memory = _memory;
 
+    // Collection table offsets are relative to the start of the collection, same as in a single file.
     void const* ptr = (void const*)ttfFile.memory;
+    if (ReadU32(ptr) == kCollectionTag)
+    {
+        uint32_t const faceCount = GetFaceCount(_memory);
+        if (_faceIndex >= faceCount)
+            return Result::FaceMissing;
+
+        ptr = (void const*)(_memory + 12 + _faceIndex * 4);
+        ptr = (void const*)(_memory + ReadU32(ptr));
+    }
+    else if (_faceIndex != 0u)
+        return Result::FaceMissing;
+    else
+        ptr = (void const*)ttfFile.memory;
     ptr = ExtractOffsetSubtable(ptr, ttfFile.offsets);
 
     if (!(ttfFile.offsets.scalerType == 0x00010000 // Windows/Adobe ttf
@@ -271,14 +968,60 @@ Result LoadTTF(uint8_t const* _memory, TrueTypeFile* _ttfFile)
         ttfFile.ymin = ReadS16(ptr);
         ttfFile.xmax = ReadS16(ptr);
         ttfFile.ymax = ReadS16(ptr);
+        ptr = AdvancePointer<uint16_t>(ptr, 3);
+        ttfFile.indexToLocFormat = ReadS16(ptr);
+    }
+
+    {
+        void const* maxpptr = AdvancePointer<uint32_t>(ttfFile.memory + ttfFile.required.maxp->offset);
+        ttfFile.glyphCount = ReadU16(maxpptr);
+    }
+
+    {
+        ptr = AdvancePointer<uint32_t>(ttfFile.memory + ttfFile.required.hhea->offset);
+        ttfFile.ascent = ReadS16(ptr);
+        ttfFile.descent = ReadS16(ptr);
+        ttfFile.lineGap = ReadS16(ptr);
+        ttfFile.advanceWidthMax = ReadU16(ptr);
+        ptr = AdvancePointer<uint16_t>(ptr, 11);
+        ttfFile.hmetricCount = ReadU16(ptr);
     }
 
     std::swap(ttfFile, *_ttfFile);
     return Result::Success;
 }
 
+Result LoadCollection(uint8_t const* _memory, FontCollection* _collection)
+{
+    uint32_t const faceCount = GetFaceCount(_memory);
+    if (faceCount == 0u)
+        return Result::UnknownScalerType;
+
+    std::vector<TrueTypeFile> faces(faceCount);
+    for (uint32_t faceIndex = 0u; faceIndex < faceCount; ++faceIndex)
+    {
+        Result const result = LoadTTF(_memory, &faces[faceIndex], faceIndex);
+        if (result != Result::Success)
+            return result;
+    }
+
+    std::swap(faces, _collection->faces);
+    return Result::Success;
+}
+
 Result ReadGlyphData(TrueTypeFile const& _ttfFile, uint32_t _characterCode, Glyph* _glyph)
 {
+    uint32_t glyphIndex = GetGlyphIndex(_ttfFile, _characterCode);
+    if (glyphIndex == 0u)
+        return Result::GlyphMissing;
+
+    return ReadGlyphIndexData(_ttfFile, glyphIndex, _glyph);
+}
+
+uint32_t GetGlyphIndex(TrueTypeFile const& _ttfFile, uint32_t _characterCode)
+{
+    TTFTK_COUNT(cmapLookups, 1);
+
     uint32_t glyphIndex = 0u;
     {
         uint8_t const* cmapBase = _ttfFile.memory + _ttfFile.required.cmap->offset;
@@ -316,46 +1059,22 @@ Result ReadGlyphData(TrueTypeFile const& _ttfFile, uint32_t _characterCode, Glyp
         }
     }
 
-    if (glyphIndex == 0u)
-        return Result::GlyphMissing;
+    return glyphIndex;
+}
 
-    void const* ptr = nullptr;
-    {
-        uint8_t const* maxpBase = _ttfFile.memory + _ttfFile.required.maxp->offset;
-        ptr = AdvancePointer<uint16_t>(maxpBase);
-        uint16_t glyphCount = ReadU16(ptr);
-        uint16_t maxPoints = ReadU16(ptr);
-        uint16_t maxContours = ReadU16(ptr);
-        uint16_t maxComponentPoints = ReadU16(ptr);
-        uint16_t maxComponentContours = ReadU16(ptr);
-        ptr = AdvancePointer<uint16_t>(ptr, 7);
-        uint16_t maxComponentElements = ReadU16(ptr);
-        uint16_t maxComponentDepth = ReadU16(ptr);
+Result ReadGlyphIndexData(TrueTypeFile const& _ttfFile, uint32_t _glyphIndex, Glyph* _glyph)
+{
+    TTFTK_SCOPED_TIMER(Stage::Decode);
+    TTFTK_COUNT(glyphDecodes, 1);
 
-        uint8_t const* headBase = _ttfFile.memory + _ttfFile.required.head->offset;
-        ptr = headBase;
-        uint32_t headversion = ReadU32(ptr);
-        uint32_t fontRevision = ReadU32(ptr);
-        uint32_t checkSumAdjustment = ReadU32(ptr);
-        uint32_t magicNumber = ReadU32(ptr);
-        uint16_t headFlags = ReadU16(ptr);
-        uint16_t unitsPerEm = ReadU16(ptr);
-        uint64_t createdTime = ReadU64(ptr);
-        uint64_t modifiedTime = ReadU64(ptr);
-        int16_t xMin = ReadS16(ptr);
-        int16_t yMin = ReadS16(ptr);
-        int16_t xMax = ReadS16(ptr);
-        int16_t yMax = ReadS16(ptr);
-        uint16_t macStyle = ReadU16(ptr);
-        uint16_t lowestRecPPEM = ReadU16(ptr);
-        int16_t fontDirectionHint = ReadS16(ptr);
-        int16_t indexToLocFormat = ReadS16(ptr);
-        int16_t glyphDataFormat = ReadS16(ptr);
+    if (_glyphIndex >= _ttfFile.glyphCount)
+        return Result::GlyphMissing;
 
+    {
         uint8_t const* locaBase = _ttfFile.memory + _ttfFile.required.loca->offset;
         uint8_t const* glyfBase = _ttfFile.memory + _ttfFile.required.glyf->offset;
 
-        GlyphPoints points = ExtractGlyphPoints(locaBase, glyfBase, indexToLocFormat, glyphIndex);
+        GlyphPoints points = ExtractGlyphPoints(locaBase, glyfBase, _ttfFile.indexToLocFormat, _glyphIndex);
 
         _glyph->xmin = points.xmin;
         _glyph->xmax = points.xmax;
@@ -477,15 +1196,14 @@ std::vector<uint32_t> ListCharCodes(TrueTypeFile const& _ttfFile)
 
             for (uint16_t segIndex = 0u; segIndex < segCount; ++segIndex)
             {
-                for (uint16_t charCode = startCode[index];
-                     charCode <= endCode[index];
+                // The table ends with a 0xFFFF segment mapped to .notdef.
+                if (startCode[segIndex] == 0xFFFFu)
+                    continue;
+
+                for (uint32_t charCode = startCode[segIndex];
+                     charCode <= endCode[segIndex];
                      ++charCode)
-                {
-                    auto it = std::lower_bound(output.begin(), output.end(),
-                                               (uint32_t)charCode);
-                    if (it == output.end() || *it != (uint32_t)charCode)
-                        output.insert(it, (uint32_t)charCode);
-                }
+                    output.push_back(charCode);
             }
         }
 
@@ -502,49 +1220,107 @@ std::vector<uint32_t> ListCharCodes(TrueTypeFile const& _ttfFile)
                 uint32_t endCharCode = ReadU32(subtableptr);
                 uint32_t startGlyphCode = ReadU32(subtableptr);
 
-                for (uint32_t charCode = startCharCode;
+                for (uint64_t charCode = startCharCode;
                      charCode <= endCharCode;
                      ++charCode)
-                {
-                    auto it = std::lower_bound(output.begin(), output.end(), charCode);
-                    if (it == output.end() || *it != charCode)
-                        output.insert(it, charCode);
-                }
+                    output.push_back((uint32_t)charCode);
             }
         }
     }
 
+    std::sort(output.begin(), output.end());
+    output.erase(std::unique(output.begin(), output.end()), output.end());
     return output;
 }
 
-int32_t EvalWindingNumber(Glyph const* _glyph, int16_t _sampleX, int16_t _sampleY, float* _coverage)
+std::vector<CharGlyphPair> ListGlyphsInFileOrder(TrueTypeFile const& _ttfFile)
+{
+    std::vector<uint32_t> const charCodes = ListCharCodes(_ttfFile);
+    return ListGlyphsInFileOrder(_ttfFile, charCodes.data(), charCodes.size());
+}
+
+std::vector<CharGlyphPair> ListGlyphsInFileOrder(TrueTypeFile const& _ttfFile, uint32_t const* _charCodes,
+                                                 size_t _count)
 {
+    std::vector<CharGlyphPair> output{};
+    output.reserve(_count);
+    for (size_t index = 0u; index < _count; ++index)
+        output.push_back(CharGlyphPair{ _charCodes[index], GetGlyphIndex(_ttfFile, _charCodes[index]) });
+    SortGlyphsInFileOrder(_ttfFile, &output);
+    return output;
+}
+
+void SortGlyphsInFileOrder(TrueTypeFile const& _ttfFile, std::vector<CharGlyphPair>* _glyphs)
+{
+    std::vector<CharGlyphPair>& output = *_glyphs;
+
+    // Lowest code first within a glyph, so that unique keeps it.
+    std::sort(output.begin(), output.end(), [](CharGlyphPair const& _lhs, CharGlyphPair const& _rhs)
+    {
+        return (_lhs.glyphIndex != _rhs.glyphIndex)
+            ? _lhs.glyphIndex < _rhs.glyphIndex
+            : _lhs.charCode < _rhs.charCode;
+    });
+    output.erase(std::unique(output.begin(), output.end(), [](CharGlyphPair const& _lhs, CharGlyphPair const& _rhs)
+    {
+        return _lhs.glyphIndex == _rhs.glyphIndex;
+    }), output.end());
+
+    // Empty glyphs share their offset with the next glyph, ties keep glyph order.
+    uint8_t const* locaBase = _ttfFile.memory + _ttfFile.required.loca->offset;
+    auto glyphOffset = [&](uint32_t _glyphIndex)
+    {
+        if (_glyphIndex >= _ttfFile.glyphCount)
+            return ~0u;
+        void const* ptr = (_ttfFile.indexToLocFormat == 0)
+            ? (void const*)(locaBase + _glyphIndex * 2)
+            : (void const*)(locaBase + _glyphIndex * 4);
+        return (_ttfFile.indexToLocFormat == 0) ? (uint32_t)ReadU16(ptr) * 2u : ReadU32(ptr);
+    };
+    std::stable_sort(output.begin(), output.end(), [&](CharGlyphPair const& _lhs, CharGlyphPair const& _rhs)
+    {
+        return glyphOffset(_lhs.glyphIndex) < glyphOffset(_rhs.glyphIndex);
+    });
+}
+
+// Crossings are decided exactly on the integer coordinates, the distance uses the float roots of the
+// int32 deltas so that samples far from a segment do not wrap.
+template <bool kDistance>
+static int32_t EvalGlyphWindingKernel(Glyph const* _glyph, int16_t _sampleX, int16_t _sampleY, float* _coverage)
+{
+    TTFTK_COUNT(windingEvals, 1);
+    if constexpr (kDistance)
+        TTFTK_COUNT(distanceEvals, 1);
+
     float coverage = std::numeric_limits<float>::infinity();
 
     int32_t windingNumber = 0;
     for (ttftk::GlyphContour const& contour : _glyph->contours)
     {
+        TTFTK_COUNT(segmentTests, (contour.x.size() - 1) / 2);
         for (size_t point = 0u; point < contour.x.size()-2; point+=2)
         {
-            int16_t pointX[3] {
-                (int16_t)(contour.x[point] - _sampleX),
-                (int16_t)(contour.x[point + 1] - _sampleX),
-                (int16_t)(contour.x[point + 2] - _sampleX)
+            int32_t const deltaX[3] {
+                contour.x[point] - _sampleX,
+                contour.x[point + 1] - _sampleX,
+                contour.x[point + 2] - _sampleX
             };
-            int16_t pointY[3] {
-                (int16_t)(contour.y[point] - _sampleY),
-                (int16_t)(contour.y[point + 1] - _sampleY),
-                (int16_t)(contour.y[point + 2] - _sampleY)
+            int32_t const deltaY[3] {
+                contour.y[point] - _sampleY,
+                contour.y[point + 1] - _sampleY,
+                contour.y[point + 2] - _sampleY
             };
 
-            float cx0 = -std::numeric_limits<float>::infinity();
-            float cx1 = -std::numeric_limits<float>::infinity();
-            uint16_t hit = IntersectSpline(pointX, pointY, &cx0, &cx1);
-            if (hit & 1 && cx0 >= 0.f) ++windingNumber;
-            if (hit & 2 && cx1 >= 0.f) --windingNumber;
+            uint16_t const hit = CrossSplineExact(deltaX, deltaY);
+            windingNumber += (int32_t)(hit & 1) - (int32_t)((hit >> 1) & 1);
 
-            if (_coverage)
+            if constexpr (kDistance)
             {
+                float const pointX[3] { (float)deltaX[0], (float)deltaX[1], (float)deltaX[2] };
+                float const pointY[3] { (float)deltaY[0], (float)deltaY[1], (float)deltaY[2] };
+                float cx0 = -std::numeric_limits<float>::infinity();
+                float cx1 = -std::numeric_limits<float>::infinity();
+                IntersectSpline(pointX, pointY, &cx0, &cx1);
                 float cy0 = -std::numeric_limits<float>::infinity();
                 float cy1 = -std::numeric_limits<float>::infinity();
                 IntersectSpline(pointY, pointX, &cy0, &cy1);
@@ -556,26 +1332,37 @@ int32_t EvalWindingNumber(Glyph const* _glyph, int16_t _sampleX, int16_t _sample
         }
     }
 
-    if (_coverage)
+    if constexpr (kDistance)
         *_coverage = coverage;
 
     return windingNumber;
 }
 
-float sdBezier(int16_t const pointX[3], int16_t const pointY[3])
+int32_t EvalWindingNumber(Glyph const* _glyph, int16_t _sampleX, int16_t _sampleY, float* _coverage)
+{
+    return _coverage
+        ? EvalGlyphWindingKernel<true>(_glyph, _sampleX, _sampleY, _coverage)
+        : EvalGlyphWindingKernel<false>(_glyph, _sampleX, _sampleY, nullptr);
+}
+
+// Integer coordinates are expanded in int32 before the conversion to float.
+template <typename T>
+float sdBezier(T const pointX[3], T const pointY[3])
 {
+    using Accum = std::conditional_t<std::is_integral_v<T>, int32_t, float>;
+
     float res = 0.f;
 
-    int32_t const a[2] = {
+    Accum const a[2] = {
         pointX[1]-pointX[0],
         pointY[1]-pointY[0]
     };
-    int32_t const b[2] = {
+    Accum const b[2] = {
         pointX[0] - 2*pointX[1] + pointX[2],
         pointY[0] - 2*pointY[1] + pointY[2]
     };
-    int32_t const c[2] = { a[0]*2, a[1]*2 };
-    int32_t const d[2] = { pointX[0], pointY[0] };
+    Accum const c[2] = { a[0]*2, a[1]*2 };
+    Accum const d[2] = { pointX[0], pointY[0] };
 
     float const kk = 1.f / (float)(b[0]*b[0]+b[1]*b[1]);
     float const kx = kk * (float)(a[0]*b[0]+a[1]*b[1]);
@@ -631,6 +1418,8 @@ float sdBezier(int16_t const pointX[3], int16_t const pointY[3])
 
 float EvalDistance(Glyph const* _glyph, int16_t _sampleX, int16_t _sampleY)
 {
+    TTFTK_COUNT(distanceEvals, 1);
+
     float distance = std::numeric_limits<float>::infinity();
 
     for (ttftk::GlyphContour const& contour : _glyph->contours)
@@ -655,368 +1444,3917 @@ float EvalDistance(Glyph const* _glyph, int16_t _sampleX, int16_t _sampleY)
     return distance;
 }
 
-void const* ExtractOffsetSubtable(void const* _ptr, OffsetSubtable& _output)
+void ClassifyPoints(Glyph const* _glyph, GlyphPoint const* _points, size_t _count, uint8_t* _inside,
+                    float* _distances, float _maxDistance)
 {
-    void const* nextPtr = AdvancePointer<OffsetSubtable>(_ptr);
-    _output.scalerType = ReadU32(_ptr);
-    _output.numTables = ReadU16(_ptr);
-    _output.searchRange = ReadU16(_ptr);
-    _output.entrySelector = ReadU16(_ptr);
-    _output.rangeShift = ReadU16(_ptr);
-    return nextPtr;
-}
+    std::vector<uint32_t> order(_count);
+    for (size_t index = 0u; index < _count; ++index)
+        order[index] = (uint32_t)index;
+    std::sort(order.begin(), order.end(), [_points](uint32_t _a, uint32_t _b)
+    {
+        return _points[_a].y < _points[_b].y;
+    });
 
-void const* ExtractTableDirectory(void const* _ptr, uint16_t _count, TableDirectoryEntry* _output)
-{
-    void const* nextPtr = AdvancePointer<TableDirectoryEntry>(_ptr, (size_t)_count);
-    for (uint16_t index = 0u; index < _count; ++index)
+    std::vector<int32_t> sortedY(_count);
+    for (size_t index = 0u; index < _count; ++index)
+        sortedY[index] = _points[order[index]].y;
+
+    auto const lowerBound = [&](int32_t _y)
     {
-        void const* ptr = AdvancePointer<TableDirectoryEntry>(_ptr);
-        _output[index].tag = ReadU32(_ptr);
-        _output[index].checkSum = ReadU32(_ptr);
-        _output[index].offset = ReadU32(_ptr);
-        _output[index].length = ReadU32(_ptr);
-        _ptr = ptr;
+        return (size_t)(std::lower_bound(sortedY.begin(), sortedY.end(), _y) - sortedY.begin());
+    };
+    auto const upperBound = [&](int32_t _y)
+    {
+        return (size_t)(std::upper_bound(sortedY.begin(), sortedY.end(), _y) - sortedY.begin());
+    };
+
+    if (_distances)
+        std::fill(_distances, _distances + _count, _maxDistance);
+    // Beyond the int16 glyph space every segment is in reach, which also covers an infinite distance.
+    bool const bounded = _maxDistance < 65536.f;
+    int32_t const reach = bounded ? (int32_t)std::ceil(std::max(_maxDistance, 0.f)) : 0;
+
+    std::vector<int32_t> windingNumbers(_count, 0);
+    for (GlyphContour const& contour : _glyph->contours)
+    {
+        for (size_t point = 0u; point + 2 < contour.x.size(); point += 2)
+        {
+            int16_t const* const x = contour.x.data() + point;
+            int16_t const* const y = contour.y.data() + point;
+            int32_t const xmin = std::min(x[0], std::min(x[1], x[2]));
+            int32_t const xmax = std::max(x[0], std::max(x[1], x[2]));
+            int32_t const ymin = std::min(y[0], std::min(y[1], y[2]));
+            int32_t const ymax = std::max(y[0], std::max(y[1], y[2]));
+
+            // A crossing needs control points above the sample and others at or below it.
+            for (size_t index = lowerBound(ymin), end = lowerBound(ymax); index < end; ++index)
+            {
+                GlyphPoint const sample = _points[order[index]];
+                int32_t const deltaX[3] { x[0] - sample.x, x[1] - sample.x, x[2] - sample.x };
+                int32_t const deltaY[3] { y[0] - sample.y, y[1] - sample.y, y[2] - sample.y };
+                uint16_t const hit = CrossSplineExact(deltaX, deltaY);
+                windingNumbers[index] += (int32_t)(hit & 1) - (int32_t)((hit >> 1) & 1);
+            }
+
+            if (!_distances)
+                continue;
+
+            size_t const begin = bounded ? lowerBound(ymin - reach) : 0u;
+            size_t const end = bounded ? upperBound(ymax + reach) : _count;
+            for (size_t index = begin; index < end; ++index)
+            {
+                uint32_t const sampleIndex = order[index];
+                GlyphPoint const sample = _points[sampleIndex];
+                if (bounded && (sample.x < xmin - reach || sample.x > xmax + reach))
+                    continue;
+
+                float const pointX[3] {
+                    (float)(x[0] - sample.x), (float)(x[1] - sample.x), (float)(x[2] - sample.x)
+                };
+                float const pointY[3] {
+                    (float)(y[0] - sample.y), (float)(y[1] - sample.y), (float)(y[2] - sample.y)
+                };
+                _distances[sampleIndex] = std::min(_distances[sampleIndex], sdBezier(pointX, pointY));
+            }
+        }
+    }
+
+    for (size_t index = 0u; index < _count; ++index)
+    {
+        uint32_t const sampleIndex = order[index];
+        _inside[sampleIndex] = (windingNumbers[index] > 0) ? 1u : 0u;
+        if (_distances && _inside[sampleIndex])
+            _distances[sampleIndex] = -_distances[sampleIndex];
     }
-    return nextPtr;
 }
 
-uint32_t ExtractGlyphIndex(void const* _ptr, uint16_t _format, uint32_t _charCode)
+void TransformGlyph(Glyph const* _glyph, float _scaleX, float _scaleY, float _offsetX, float _offsetY,
+                    GlyphOutline* _outline)
 {
-    uint32_t glyphIndex = 0u;
+    GlyphOutline& outline = *_outline;
+    outline.x.clear();
+    outline.y.clear();
+    outline.contourEnds.clear();
+    outline.contourEnds.reserve(_glyph->contours.size());
 
-    if (_format == 4)
+    for (GlyphContour const& contour : _glyph->contours)
     {
-        uint16_t length = ReadU16(_ptr);
-        uint16_t language = ReadU16(_ptr);
-        uint16_t segCount = ReadU16(_ptr) / 2;
-        uint16_t searchRange = ReadU16(_ptr);
-        uint16_t entrySelector = ReadU16(_ptr);
-        uint16_t rangeShift = ReadU16(_ptr);
-        std::vector<uint16_t> endCode(segCount);
-        _ptr = ReadU16(_ptr, endCode.data(), endCode.size());
-        uint16_t reservedPad = ReadU16(_ptr);
-        std::vector<uint16_t> startCode(segCount);
-        _ptr = ReadU16(_ptr, startCode.data(), startCode.size());
-        std::vector<uint16_t> idDelta(segCount);
-        _ptr = ReadU16(_ptr, idDelta.data(), idDelta.size());
-        std::vector<uint16_t> idRangeOffset(segCount);
-        _ptr = ReadU16(_ptr, idRangeOffset.data(), idRangeOffset.size());
-        uint16_t const* glyphIndexArrayBase = (uint16_t const*)_ptr;
+        for (size_t point = 0u; point < contour.x.size(); ++point)
+        {
+            outline.x.push_back((float)contour.x[point] * _scaleX + _offsetX);
+            outline.y.push_back((float)contour.y[point] * _scaleY + _offsetY);
+        }
+        outline.contourEnds.push_back((uint32_t)outline.x.size());
+    }
 
-        //std::cout << std::dec << "seg count " << segCount << std::endl;
-        for (uint16_t index = 0u; index < segCount; ++index)
+    outline.xmin = (float)_glyph->xmin * _scaleX + _offsetX;
+    outline.xmax = (float)_glyph->xmax * _scaleX + _offsetX;
+    outline.ymin = (float)_glyph->ymin * _scaleY + _offsetY;
+    outline.ymax = (float)_glyph->ymax * _scaleY + _offsetY;
+    if (outline.xmin > outline.xmax)
+        std::swap(outline.xmin, outline.xmax);
+    if (outline.ymin > outline.ymax)
+        std::swap(outline.ymin, outline.ymax);
+}
+
+// The distance branch is resolved at compile time, EvalWindingNumber dispatches on _coverage.
+template <bool kDistance>
+static inline int32_t EvalWindingNumberKernel(GlyphOutline const* _outline, float _sampleX, float _sampleY,
+                                              float* _coverage)
+{
+    TTFTK_COUNT(windingEvals, 1);
+    if constexpr (kDistance)
+        TTFTK_COUNT(distanceEvals, 1);
+
+    float coverage = std::numeric_limits<float>::infinity();
+
+    int32_t windingNumber = 0;
+    uint32_t contourBegin = 0u;
+    for (uint32_t contourEnd : _outline->contourEnds)
+    {
+        TTFTK_COUNT(segmentTests, (contourEnd - contourBegin - 1) / 2);
+        for (uint32_t point = contourBegin; point + 2 < contourEnd; point += 2)
         {
-            if ((uint32_t)endCode[index] >= _charCode)
+            float const pointX[3] {
+                _outline->x[point] - _sampleX,
+                _outline->x[point + 1] - _sampleX,
+                _outline->x[point + 2] - _sampleX
+            };
+            float const pointY[3] {
+                _outline->y[point] - _sampleY,
+                _outline->y[point + 1] - _sampleY,
+                _outline->y[point + 2] - _sampleY
+            };
+
+            float cx0 = -std::numeric_limits<float>::infinity();
+            float cx1 = -std::numeric_limits<float>::infinity();
+            uint16_t hit = IntersectSpline(pointX, pointY, &cx0, &cx1);
+            if (hit & 1 && cx0 >= 0.f) ++windingNumber;
+            if (hit & 2 && cx1 >= 0.f) --windingNumber;
+
+            if constexpr (kDistance)
             {
-                if ((uint32_t)startCode[index] > _charCode)
+                float cy0 = -std::numeric_limits<float>::infinity();
+                float cy1 = -std::numeric_limits<float>::infinity();
+                IntersectSpline(pointY, pointX, &cy0, &cy1);
+                float minx = (std::abs(cx0) < std::abs(cx1)) ? cx0 : cx1;
+                float miny = (std::abs(cy0) < std::abs(cy1)) ? cy0 : cy1;
+                float minv = (std::abs(minx) < std::abs(miny)) ? minx : miny;
+                coverage = (std::abs(coverage) < std::abs(minv)) ? coverage : minv;
+            }
+        }
+        contourBegin = contourEnd;
+    }
+
+    if constexpr (kDistance)
+        *_coverage = coverage;
+
+    return windingNumber;
+}
+
+int32_t EvalWindingNumber(GlyphOutline const* _outline, float _sampleX, float _sampleY, float* _coverage)
+{
+    return _coverage
+        ? EvalWindingNumberKernel<true>(_outline, _sampleX, _sampleY, _coverage)
+        : EvalWindingNumberKernel<false>(_outline, _sampleX, _sampleY, nullptr);
+}
+
+float EvalDistance(GlyphOutline const* _outline, float _sampleX, float _sampleY)
+{
+    TTFTK_COUNT(distanceEvals, 1);
+
+    float distance = std::numeric_limits<float>::infinity();
+
+    uint32_t contourBegin = 0u;
+    for (uint32_t contourEnd : _outline->contourEnds)
+    {
+        for (uint32_t point = contourBegin; point + 2 < contourEnd; point += 2)
+        {
+            float const pointX[3] {
+                _outline->x[point] - _sampleX,
+                _outline->x[point + 1] - _sampleX,
+                _outline->x[point + 2] - _sampleX
+            };
+            float const pointY[3] {
+                _outline->y[point] - _sampleY,
+                _outline->y[point + 1] - _sampleY,
+                _outline->y[point + 2] - _sampleY
+            };
+
+            distance = std::min(distance, sdBezier(pointX, pointY));
+        }
+        contourBegin = contourEnd;
+    }
+
+    return distance;
+}
+
+GlyphMetrics GetGlyphMetrics(TrueTypeFile const& _ttfFile, uint32_t _glyphIndex)
+{
+    GlyphMetrics metrics{};
+    if (_ttfFile.hmetricCount == 0u)
+        return metrics;
+
+    uint8_t const* hmtxBase = _ttfFile.memory + _ttfFile.required.hmtx->offset;
+
+    // Glyphs past hmetricCount share the last advance width and only store their lsb.
+    if (_glyphIndex < _ttfFile.hmetricCount)
+    {
+        void const* ptr = hmtxBase + _glyphIndex * 4;
+        metrics.advanceWidth = ReadU16(ptr);
+        metrics.leftSideBearing = ReadS16(ptr);
+    }
+    else
+    {
+        void const* ptr = hmtxBase + (_ttfFile.hmetricCount - 1) * 4;
+        metrics.advanceWidth = ReadU16(ptr);
+        ptr = hmtxBase + _ttfFile.hmetricCount * 4 + (_glyphIndex - _ttfFile.hmetricCount) * 2;
+        metrics.leftSideBearing = ReadS16(ptr);
+    }
+
+    return metrics;
+}
+
+Result LayoutText(TrueTypeFile const& _ttfFile, uint32_t const* _charCodes, size_t _count,
+                  TextRun* _run, KerningTable const* _kerning)
+{
+    TextRun& run = *_run;
+    run.glyphIndices.clear();
+    run.placements.clear();
+    run.placements.reserve(_count);
+    run.advance = 0;
+
+    std::unordered_map<uint32_t, uint32_t> uniqueLUT{};
+    for (size_t index = 0u; index < _count; ++index)
+    {
+        GlyphPlacement placement{};
+        placement.charCode = _charCodes[index];
+        placement.glyphIndex = GetGlyphIndex(_ttfFile, placement.charCode);
+
+        auto it = uniqueLUT.find(placement.glyphIndex);
+        if (it == uniqueLUT.end())
+        {
+            it = uniqueLUT.emplace(placement.glyphIndex, (uint32_t)run.glyphIndices.size()).first;
+            run.glyphIndices.push_back(placement.glyphIndex);
+        }
+        placement.uniqueIndex = it->second;
+
+        placement.metrics = GetGlyphMetrics(_ttfFile, placement.glyphIndex);
+        if (_kerning && index > 0u)
+            run.advance += GetKerning(*_kerning, run.placements.back().glyphIndex, placement.glyphIndex);
+        placement.penX = run.advance;
+        run.advance += placement.metrics.advanceWidth;
+
+        run.placements.push_back(placement);
+    }
+
+    return Result::Success;
+}
+
+// Calls _visit(charCode, glyphIndex) for every code the Unicode subtables map to a glyph other than
+// .notdef, walking each subtable's segments once. A code mapped by several subtables is visited once
+// per subtable, in cmap order, the first of them being the one GetGlyphIndex returns. Segments and
+// groups only own the codes no earlier one reaches, as in ExtractGlyphIndex.
+template <typename Visit>
+static void VisitCharGlyphs(TrueTypeFile const& _ttfFile, Visit const& _visit)
+{
+    uint8_t const* cmapBase = _ttfFile.memory + _ttfFile.required.cmap->offset;
+    void const* cmapptr = (void const*)cmapBase;
+
+    ReadU16(cmapptr); // version
+    uint16_t const tableCount = ReadU16(cmapptr);
+
+    for (uint16_t index = 0u; index < tableCount; ++index)
+    {
+        uint16_t const platformID = ReadU16(cmapptr);
+        uint16_t const platformSpecificID = ReadU16(cmapptr);
+        uint32_t const offset = ReadU32(cmapptr);
+
+        if (!((platformID == 0u
+               && platformSpecificID < 7)
+              || (platformID == 3u
+                  && (platformSpecificID == 10
+                      || platformSpecificID == 1))))
+            continue;
+
+        void const* subtableptr = (void const*)(cmapBase + offset);
+        uint16_t const format = ReadU16(subtableptr);
+
+        if (format == 4)
+        {
+            ReadU16(subtableptr); // length
+            ReadU16(subtableptr); // language
+            uint16_t const segCount = ReadU16(subtableptr) / 2;
+            subtableptr = AdvancePointer<uint16_t>(subtableptr, 3); // searchRange, entrySelector, rangeShift
+            uint8_t const* endCodes = (uint8_t const*)subtableptr;
+            uint8_t const* startCodes = endCodes + segCount * 2u + 2u;
+            uint8_t const* idDeltas = startCodes + segCount * 2u;
+            uint8_t const* idRangeOffsets = idDeltas + segCount * 2u;
+
+            int32_t reached = -1;
+            for (uint16_t segIndex = 0u; segIndex < segCount; ++segIndex)
+            {
+                void const* ptr = endCodes + segIndex * 2u;
+                int32_t const endCode = ReadU16(ptr);
+                ptr = startCodes + segIndex * 2u;
+                int32_t const startCode = ReadU16(ptr);
+                ptr = idDeltas + segIndex * 2u;
+                uint16_t const idDelta = ReadU16(ptr);
+                uint8_t const* idRangeOffset = idRangeOffsets + segIndex * 2u;
+                ptr = idRangeOffset;
+                uint16_t const rangeOffset = ReadU16(ptr);
+
+                int32_t const first = std::max(startCode, reached + 1);
+                reached = std::max(reached, endCode);
+                // The table ends with a 0xFFFF segment mapped to .notdef.
+                if (startCode == 0xFFFF)
+                    continue;
+
+                for (int32_t charCode = first; charCode <= endCode; ++charCode)
                 {
-                    //std::cout << "missing glyph" << std::endl;
-                    break;
+                    uint32_t glyphIndex;
+                    if (rangeOffset == 0u)
+                        glyphIndex = (uint32_t)(idDelta + charCode) & 0xffff;
+                    else
+                    {
+                        ptr = idRangeOffset + rangeOffset + (charCode - startCode) * 2u;
+                        glyphIndex = ReadU16(ptr);
+                    }
+                    if (glyphIndex != 0u)
+                        _visit((uint32_t)charCode, glyphIndex);
                 }
+            }
+        }
 
-                /*
-                std::cout << "glyph page location " << index << std::endl;
-                std::cout << std::hex
-                          << "page begin " << startCode[index] << std::endl
-                          << "page end " << endCode[index] << std::endl
-                          << "idRangeOffset " << idRangeOffset[index] << std::endl
-                          << "idDelta " << idDelta[index] << std::endl;
-                */
+        if (format == 12)
+        {
+            ReadU16(subtableptr); // reserved u16
+            ReadU32(subtableptr); // length
+            ReadU32(subtableptr); // language
+            uint32_t const nGroups = ReadU32(subtableptr);
 
-                if (!idRangeOffset[index])
-                    glyphIndex = (uint32_t)(idDelta[index] + _charCode) & 0xffff;
-                else
+            int64_t reached = -1;
+            for (uint32_t groupIndex = 0u; groupIndex < nGroups; ++groupIndex)
+            {
+                uint32_t const startCharCode = ReadU32(subtableptr);
+                uint32_t const endCharCode = ReadU32(subtableptr);
+                uint32_t const startGlyphCode = ReadU32(subtableptr);
+
+                int64_t const first = std::max<int64_t>(startCharCode, reached + 1);
+                reached = std::max<int64_t>(reached, endCharCode);
+                for (int64_t charCode = first; charCode <= (int64_t)endCharCode; ++charCode)
                 {
-                    uint32_t offset = idRangeOffset[index]/2 + (_charCode - startCode[index]);
-                    void const* pIndex = glyphIndexArrayBase + offset + index - segCount;
-                    glyphIndex = (uint32_t)ReadU16(pIndex);
+                    uint32_t const glyphIndex = startGlyphCode + (uint32_t)(charCode - startCharCode);
+                    if (glyphIndex != 0u)
+                        _visit((uint32_t)charCode, glyphIndex);
                 }
+            }
+        }
+    }
+}
+
+void BuildFontCoverage(TrueTypeFile const& _ttfFile, FontCoverage* _coverage)
+{
+    FontCoverage& coverage = *_coverage;
+    coverage.pageBlocks.assign(kCoveragePageCount, kCoverageNoPage);
+    coverage.bits.clear();
+    coverage.glyphs.clear();
+
+    // Codes already set came from an earlier subtable, which is the one GetGlyphIndex uses.
+    VisitCharGlyphs(_ttfFile, [&](uint32_t _charCode, uint32_t _glyphIndex)
+    {
+        if (_charCode >= 0x110000u)
+            return;
+
+        uint16_t& block = coverage.pageBlocks[_charCode >> 8];
+        if (block == kCoverageNoPage)
+        {
+            block = (uint16_t)coverage.bits.size();
+            coverage.bits.resize(coverage.bits.size() + 4u, 0u);
+            coverage.glyphs.resize(coverage.glyphs.size() + 256u, 0u);
+        }
+        uint64_t& word = coverage.bits[block + ((_charCode >> 6) & 3u)];
+        uint64_t const bit = 1ull << (_charCode & 63u);
+        if (word & bit)
+            return;
+        word |= bit;
+        coverage.glyphs[((size_t)block << 6) + (_charCode & 0xFFu)] = (uint16_t)_glyphIndex;
+    });
+}
+
+bool IsCovered(FontCoverage const& _coverage, uint32_t _charCode)
+{
+    if (_charCode >= 0x110000u)
+        return false;
+
+    uint16_t const block = _coverage.pageBlocks[_charCode >> 8];
+    return block != kCoverageNoPage && ((_coverage.bits[block + ((_charCode >> 6) & 3u)] >> (_charCode & 63u)) & 1u);
+}
+
+uint32_t RegisterFont(FontRegistry* _registry, TrueTypeFile const& _ttfFile)
+{
+    _registry->fonts.push_back(&_ttfFile);
+    _registry->coverage.emplace_back();
+    BuildFontCoverage(_ttfFile, &_registry->coverage.back());
+    return (uint32_t)(_registry->fonts.size() - 1u);
+}
+
+uint32_t CreateFallbackChain(FontRegistry* _registry, uint32_t const* _fonts, size_t _count)
+{
+    FallbackChain chain{};
+    chain.fonts.assign(_fonts, _fonts + std::min<size_t>(_count, 255u));
+    chain.pageSlots.assign(kCoveragePageCount, kCoverageNoPage);
+
+    for (uint32_t page = 0u; page < kCoveragePageCount; ++page)
+    {
+        for (uint32_t position = 0u; position < chain.fonts.size(); ++position)
+        {
+            FontCoverage const& coverage = _registry->coverage[chain.fonts[position]];
+            uint16_t const block = coverage.pageBlocks[page];
+            if (block == kCoverageNoPage)
+                continue;
+
+            if (chain.pageSlots[page] == kCoverageNoPage)
+            {
+                chain.pageSlots[page] = (uint16_t)(chain.codeFonts.size() >> 8);
+                chain.codeFonts.resize(chain.codeFonts.size() + 256u, 0xFFu);
+                chain.codeGlyphs.resize(chain.codeGlyphs.size() + 256u, 0u);
+            }
+
+            size_t const slot = (size_t)chain.pageSlots[page] << 8;
+            uint16_t const* glyphs = &coverage.glyphs[(size_t)block << 6];
+            for (uint32_t code = 0u; code < 256u; ++code)
+            {
+                if (chain.codeFonts[slot + code] != 0xFFu || !((coverage.bits[block + (code >> 6)] >> (code & 63u)) & 1u))
+                    continue;
+                chain.codeFonts[slot + code] = (uint8_t)position;
+                chain.codeGlyphs[slot + code] = glyphs[code];
+            }
+        }
+    }
+
+    _registry->chains.push_back(std::move(chain));
+    return (uint32_t)(_registry->chains.size() - 1u);
+}
+
+uint32_t FindCoveringFont(FontRegistry const& _registry, uint32_t _chain, uint32_t _charCode,
+                          uint32_t* _glyphIndex)
+{
+    if (_chain >= _registry.chains.size() || _charCode >= 0x110000u)
+        return kRegistryNoFont;
+
+    FallbackChain const& chain = _registry.chains[_chain];
+    uint16_t const slot = chain.pageSlots[_charCode >> 8];
+    if (slot == kCoverageNoPage)
+        return kRegistryNoFont;
+
+    size_t const code = ((size_t)slot << 8) | (_charCode & 0xFFu);
+    if (chain.codeFonts[code] == 0xFFu)
+        return kRegistryNoFont;
+
+    if (_glyphIndex)
+        *_glyphIndex = chain.codeGlyphs[code];
+    return chain.fonts[chain.codeFonts[code]];
+}
+
+void ResolveFontRuns(FontRegistry const& _registry, uint32_t _chain, uint32_t const* _charCodes, size_t _count,
+                     std::vector<FontRun>* _runs, std::vector<uint32_t>* _glyphIndices)
+{
+    std::vector<FontRun>& runs = *_runs;
+    std::vector<uint32_t>& glyphIndices = *_glyphIndices;
+    runs.clear();
+    glyphIndices.resize(_count);
+    if (_chain >= _registry.chains.size() || _registry.chains[_chain].fonts.empty())
+    {
+        std::fill(glyphIndices.begin(), glyphIndices.end(), 0u);
+        return;
+    }
+
+    uint32_t currentFont = _registry.chains[_chain].fonts[0];
+    for (size_t index = 0u; index < _count; ++index)
+    {
+        uint32_t glyphIndex = 0u;
+        uint32_t const font = FindCoveringFont(_registry, _chain, _charCodes[index], &glyphIndex);
+        if (font != kRegistryNoFont)
+            currentFont = font;
+
+        if (!runs.empty() && runs.back().font == currentFont)
+            runs.back().end = (uint32_t)index + 1u;
+        else
+            runs.push_back(FontRun{ currentFont, (uint32_t)index, (uint32_t)index + 1u });
+        glyphIndices[index] = glyphIndex;
+    }
+}
+
+static inline uint32_t KerningPairSlot(uint32_t _key, uint32_t _mask)
+{
+    return ((_key * 0x9E3779B1u) >> 12) & _mask;
+}
+
+static void InsertKerningPair(KerningTable& _kerning, uint32_t _key, int16_t _value, bool _override)
+{
+    uint32_t slot = KerningPairSlot(_key, _kerning.pairMask);
+    while (_kerning.pairKeys[slot] != ~0u && _kerning.pairKeys[slot] != _key)
+        slot = (slot + 1) & _kerning.pairMask;
+
+    if (_kerning.pairKeys[slot] == _key && !_override)
+        _kerning.pairValues[slot] += _value;
+    else
+        _kerning.pairValues[slot] = _value;
+    _kerning.pairKeys[slot] = _key;
+}
+
+static void CompileKerningClassMatrix(uint8_t const* _subtableBase, uint8_t const* _formatData,
+                                      uint8_t const* _subtableEnd, KerningClassMatrix& _matrix)
+{
+    void const* ptr = (void const*)_formatData;
+    uint16_t rowWidth = ReadU16(ptr);
+    uint16_t leftClassOffset = ReadU16(ptr);
+    uint16_t rightClassOffset = ReadU16(ptr);
+    uint16_t arrayOffset = ReadU16(ptr);
+
+    // Class values are byte offsets from the subtable start, left ones premultiplied by the row
+    // width. Remap them to dense row/column indices.
+    std::vector<uint16_t> leftValues{};
+    ptr = (void const*)(_subtableBase + leftClassOffset);
+    _matrix.firstLeft = ReadU16(ptr);
+    leftValues.resize(ReadU16(ptr));
+    ReadU16(ptr, leftValues.data(), leftValues.size());
+
+    std::vector<uint16_t> rightValues{};
+    ptr = (void const*)(_subtableBase + rightClassOffset);
+    _matrix.firstRight = ReadU16(ptr);
+    rightValues.resize(ReadU16(ptr));
+    ReadU16(ptr, rightValues.data(), rightValues.size());
+
+    std::vector<uint16_t> rows(leftValues);
+    std::sort(rows.begin(), rows.end());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+    std::vector<uint16_t> columns(rightValues);
+    std::sort(columns.begin(), columns.end());
+    columns.erase(std::unique(columns.begin(), columns.end()), columns.end());
+
+    // Row and column 0 are reserved for glyphs outside of the class tables.
+    _matrix.columnCount = (uint16_t)(columns.size() + 1);
+    _matrix.leftRows.resize(leftValues.size());
+    for (size_t index = 0u; index < leftValues.size(); ++index)
+        _matrix.leftRows[index] = (uint16_t)(1 + std::lower_bound(rows.begin(), rows.end(), leftValues[index])
+                                             - rows.begin());
+    _matrix.rightColumns.resize(rightValues.size());
+    for (size_t index = 0u; index < rightValues.size(); ++index)
+        _matrix.rightColumns[index] = (uint16_t)(1 + std::lower_bound(columns.begin(), columns.end(),
+                                                                      rightValues[index]) - columns.begin());
+
+    _matrix.values.assign((rows.size() + 1) * _matrix.columnCount, 0);
+    for (size_t row = 0u; row < rows.size(); ++row)
+    {
+        for (size_t column = 0u; column < columns.size(); ++column)
+        {
+            uint32_t const offset = (uint32_t)rows[row] + (uint32_t)columns[column];
+            if (offset < arrayOffset || _subtableBase + offset + 2 > _subtableEnd)
+                continue;
+
+            void const* valueptr = (void const*)(_subtableBase + offset);
+            _matrix.values[(row + 1) * _matrix.columnCount + column + 1] = ReadS16(valueptr);
+        }
+    }
+}
+
+Result CompileKerning(TrueTypeFile const& _ttfFile, KerningTable* _kerning)
+{
+    KerningTable kerning{};
+    kerning.pairMask = 0u;
+    kerning.pairKeys.assign(1, ~0u);
+    kerning.pairValues.assign(1, 0);
+
+    if (!_ttfFile.optional.kern)
+    {
+        std::swap(kerning, *_kerning);
+        return Result::Success;
+    }
+
+    uint8_t const* kernBase = _ttfFile.memory + _ttfFile.optional.kern->offset;
+    void const* ptr = (void const*)kernBase;
+
+    // Microsoft tables start with a u16 version 0, Apple ones with a u32 version 0x00010000.
+    bool const appleFormat = (ReadU16(ptr) == 1u);
+    uint32_t tableCount = 0u;
+    if (appleFormat)
+    {
+        ReadU16(ptr);
+        tableCount = ReadU32(ptr);
+    }
+    else
+        tableCount = ReadU16(ptr);
+
+    struct PendingSubtable
+    {
+        uint8_t const* data;
+        uint8_t const* end;
+        uint8_t format;
+        bool override;
+    };
+    std::vector<PendingSubtable> subtables{};
+    uint32_t pairCount = 0u;
+
+    for (uint32_t index = 0u; index < tableCount; ++index)
+    {
+        uint8_t const* subtableBase = (uint8_t const*)ptr;
+        uint32_t length = 0u;
+        uint8_t format = 0u;
+        bool usable = false;
+        bool override = false;
+        if (appleFormat)
+        {
+            length = ReadU32(ptr);
+            uint16_t coverage = ReadU16(ptr);
+            uint16_t tupleIndex = ReadU16(ptr);
+            format = (uint8_t)(coverage & 0xff);
+            usable = !(coverage & 0xe000);
+        }
+        else
+        {
+            uint16_t version = ReadU16(ptr);
+            length = ReadU16(ptr);
+            uint16_t coverage = ReadU16(ptr);
+            format = (uint8_t)(coverage >> 8);
+            usable = ((coverage & 0x7) == 0x1);
+            override = !!(coverage & 0x8);
+        }
+
+        if (usable && format == 0)
+        {
+            void const* pairptr = ptr;
+            pairCount += ReadU16(pairptr);
+        }
+
+        if (usable && (format == 0 || format == 2))
+            subtables.push_back({ (uint8_t const*)ptr, subtableBase + length, format, override });
+
+        ptr = (void const*)(subtableBase + length);
+    }
+
+    uint32_t capacity = 1u;
+    while (capacity < pairCount * 2u)
+        capacity <<= 1;
+    kerning.pairMask = capacity - 1u;
+    kerning.pairKeys.assign(capacity, ~0u);
+    kerning.pairValues.assign(capacity, 0);
+
+    for (PendingSubtable const& subtable : subtables)
+    {
+        if (subtable.format == 0)
+        {
+            ptr = (void const*)subtable.data;
+            uint16_t nPairs = ReadU16(ptr);
+            ptr = AdvancePointer<uint16_t>(ptr, 3);
+            for (uint16_t pairIndex = 0u; pairIndex < nPairs; ++pairIndex)
+            {
+                uint16_t left = ReadU16(ptr);
+                uint16_t right = ReadU16(ptr);
+                int16_t value = ReadS16(ptr);
+                InsertKerningPair(kerning, ((uint32_t)left << 16) | right, value, subtable.override);
+            }
+        }
+        else
+        {
+            // Class and array offsets are relative to the start of the subtable header.
+            uint8_t const* base = subtable.data - (appleFormat ? 8 : 6);
+            kerning.classMatrices.emplace_back();
+            CompileKerningClassMatrix(base, subtable.data, subtable.end, kerning.classMatrices.back());
+        }
+    }
+
+    std::swap(kerning, *_kerning);
+    return Result::Success;
+}
+
+int16_t GetKerning(KerningTable const& _kerning, uint32_t _left, uint32_t _right)
+{
+    int32_t value = 0;
+
+    uint32_t const key = (_left << 16) | (_right & 0xffff);
+    uint32_t slot = KerningPairSlot(key, _kerning.pairMask);
+    while (_kerning.pairKeys[slot] != ~0u)
+    {
+        if (_kerning.pairKeys[slot] == key)
+        {
+            value += _kerning.pairValues[slot];
+            break;
+        }
+        slot = (slot + 1) & _kerning.pairMask;
+    }
+
+    for (KerningClassMatrix const& matrix : _kerning.classMatrices)
+    {
+        uint32_t const leftIndex = _left - matrix.firstLeft;
+        uint32_t const rightIndex = _right - matrix.firstRight;
+        uint32_t const row = (leftIndex < matrix.leftRows.size()) ? matrix.leftRows[leftIndex] : 0u;
+        uint32_t const column = (rightIndex < matrix.rightColumns.size()) ? matrix.rightColumns[rightIndex] : 0u;
+        value += matrix.values[row * matrix.columnCount + column];
+    }
+
+    return (int16_t)value;
+}
+
+void GetKerning(KerningTable const& _kerning, uint32_t const* _glyphIndices, size_t _count,
+                int16_t* _adjustments)
+{
+    if (_count == 0u)
+        return;
+
+    for (size_t index = 0u; index + 1 < _count; ++index)
+        _adjustments[index] = GetKerning(_kerning, _glyphIndices[index], _glyphIndices[index + 1]);
+    _adjustments[_count - 1] = 0;
+}
+
+void RasterizeOutlineGeneric(GlyphOutline const* _outline, uint32_t _samplingRate, bool _subPixelEval,
+                             RasterSurface const& _surface)
+{
+    uint32_t const sampleCount = (1 << (_samplingRate*2));
+    float const pixelSize = 1.f / (float)(1 << _samplingRate);
+
+    for (uint32_t y = 0; y < _surface.height; ++y)
+    {
+        uint8_t* const row = _surface.pixels + y * _surface.stride;
+        float const rowTop = (float)(_surface.height - y);
+
+        for (uint32_t x = 0; x < _surface.width; ++x)
+        {
+            float accum = 0.f;
+            for (uint32_t s = 0; s < sampleCount; ++s)
+            {
+                int sx = s & ((1 << _samplingRate) - 1);
+                int sy = (s & (((1 << _samplingRate) - 1) << _samplingRate)) >> _samplingRate;
+
+                float const sampleX = (float)x + ((float)sx + 0.5f) * pixelSize;
+                float const sampleY = rowTop - ((float)sy + 0.5f) * pixelSize;
+
+                float coverage = 0.f;
+                float distance = pixelSize*0.5f;
+                int32_t windingNumber =
+                    EvalWindingNumber(_outline, sampleX, sampleY, (_subPixelEval ? &distance : nullptr));
+
+                if (windingNumber > 0)
+                    coverage = 1.f-std::max(0.5f-(std::abs(distance)/pixelSize), 0.f);
+                else if (std::abs(distance) < pixelSize*0.5f)
+                    coverage = std::max(0.5f-(std::abs(distance) / pixelSize), 0.f);
+
+                accum += (255.f * coverage) / sampleCount;
+            }
+
+            row[x] = (uint8_t)std::round(accum);
+        }
+    }
+}
+
+// Sample loops have compile time trip counts and the coverage mode is resolved statically.
+// Samples are accumulated in the same order as RasterizeOutlineGeneric, output is identical.
+template <uint32_t kSamplingRate, bool kSubPixelEval>
+static inline uint8_t SamplePixel(GlyphOutline const* _outline, float const* _sampleOffsets,
+                                  float _pixelLeft, float _pixelTop)
+{
+    static constexpr uint32_t kSide = 1u << kSamplingRate;
+    static constexpr uint32_t kSampleCount = kSide * kSide;
+    static constexpr float kPixelSize = 1.f / (float)kSide;
+
+    float accum = 0.f;
+    for (uint32_t sy = 0; sy < kSide; ++sy)
+    {
+        float const sampleY = _pixelTop - _sampleOffsets[sy];
+        for (uint32_t sx = 0; sx < kSide; ++sx)
+        {
+            float const sampleX = _pixelLeft + _sampleOffsets[sx];
+
+            float coverage = 0.f;
+            if constexpr (kSubPixelEval)
+            {
+                float distance = kPixelSize*0.5f;
+                int32_t const windingNumber =
+                    EvalWindingNumberKernel<true>(_outline, sampleX, sampleY, &distance);
+
+                if (windingNumber > 0)
+                    coverage = 1.f-std::max(0.5f-(std::abs(distance)/kPixelSize), 0.f);
+                else if (std::abs(distance) < kPixelSize*0.5f)
+                    coverage = std::max(0.5f-(std::abs(distance) / kPixelSize), 0.f);
+            }
+            else
+            {
+                int32_t const windingNumber =
+                    EvalWindingNumberKernel<false>(_outline, sampleX, sampleY, nullptr);
+                coverage = (windingNumber > 0) ? 1.f : 0.f;
+            }
+
+            accum += (255.f * coverage) / kSampleCount;
+        }
+    }
+
+    return (uint8_t)std::round(accum);
+}
+
+struct SegmentBounds
+{
+    float xmin, ymin, xmax, ymax;
+};
+
+static inline bool Overlaps(SegmentBounds const& _bounds, float _left, float _bottom, float _right, float _top)
+{
+    return _bounds.xmin < _right && _bounds.xmax > _left && _bounds.ymin < _top && _bounds.ymax > _bottom;
+}
+
+// Segment bounds are grown by the distance falloff of the sampling mode. The slack covers the
+// rounding of crossings evaluated right on the margin.
+static inline float SegmentMargin(uint32_t _samplingRate, bool _subPixelEval)
+{
+    return (_subPixelEval ? 0.5f / (float)(1u << _samplingRate) : 0.f) + 1.f / 64.f;
+}
+
+// The runtime rate path and single binary samples do not classify pixels.
+static inline bool UsesSegmentBounds(uint32_t _samplingRate, bool _subPixelEval)
+{
+    return _samplingRate <= 3u && (_samplingRate > 0u || _subPixelEval);
+}
+
+static void BuildSegmentBounds(GlyphOutline const* _outline, float _margin, std::vector<SegmentBounds>* _segments)
+{
+    std::vector<SegmentBounds>& segments = *_segments;
+    segments.clear();
+    segments.reserve(_outline->x.size() / 2);
+    uint32_t contourBegin = 0u;
+    for (uint32_t contourEnd : _outline->contourEnds)
+    {
+        for (uint32_t point = contourBegin; point + 2 < contourEnd; point += 2)
+        {
+            float const* const x = _outline->x.data() + point;
+            float const* const y = _outline->y.data() + point;
+            SegmentBounds bounds;
+            bounds.xmin = std::min(x[0], std::min(x[1], x[2])) - _margin;
+            bounds.xmax = std::max(x[0], std::max(x[1], x[2])) + _margin;
+            bounds.ymin = std::min(y[0], std::min(y[1], y[2])) - _margin;
+            bounds.ymax = std::max(y[0], std::max(y[1], y[2])) + _margin;
+            segments.push_back(bounds);
+        }
+        contourBegin = contourEnd;
+    }
+}
+
+// Pixels are classified by 8x8 blocks against the segment bounds, grown by SegmentMargin.
+// A block or pixel no segment reaches has a constant winding number and every sample in it gets a
+// coverage of exactly 0 or 1, so it is filled from a single winding test.
+template <uint32_t kSamplingRate, bool kSubPixelEval>
+void RasterizeOutlineKernel(GlyphOutline const* _outline, std::vector<SegmentBounds> const& _segments,
+                            RasterSurface const& _surface, std::vector<uint32_t>* _candidates)
+{
+    static constexpr uint32_t kSide = 1u << kSamplingRate;
+    static constexpr uint32_t kSampleCount = kSide * kSide;
+    static constexpr float kPixelSize = 1.f / (float)kSide;
+    static constexpr uint32_t kBlockSize = 8u;
+
+    float sampleOffsets[kSide];
+    for (uint32_t s = 0; s < kSide; ++s)
+        sampleOffsets[s] = ((float)s + 0.5f) * kPixelSize;
+
+    float fullAccum = 0.f;
+    for (uint32_t s = 0; s < kSampleCount; ++s)
+        fullAccum += (255.f * 1.f) / kSampleCount;
+    uint8_t const fullValue = (uint8_t)std::round(fullAccum);
+
+    // A single binary sample costs no more than the classification itself.
+    if constexpr (kSampleCount == 1u && !kSubPixelEval)
+    {
+        for (uint32_t y = 0; y < _surface.height; ++y)
+        {
+            uint8_t* const row = _surface.pixels + y * _surface.stride;
+            float const rowTop = (float)(_surface.height - y);
+            for (uint32_t x = 0; x < _surface.width; ++x)
+                row[x] = SamplePixel<kSamplingRate, kSubPixelEval>(_outline, sampleOffsets, (float)x, rowTop);
+        }
+        return;
+    }
+
+    std::vector<SegmentBounds> const& segments = _segments;
+    std::vector<uint32_t>& candidates = *_candidates;
+
+    for (uint32_t blockY = 0; blockY < _surface.height; blockY += kBlockSize)
+    {
+        uint32_t const blockHeight = std::min(kBlockSize, _surface.height - blockY);
+        float const blockTop = (float)(_surface.height - blockY);
+        float const blockBottom = blockTop - (float)blockHeight;
+
+        for (uint32_t blockX = 0; blockX < _surface.width; blockX += kBlockSize)
+        {
+            uint32_t const blockWidth = std::min(kBlockSize, _surface.width - blockX);
+            float const blockLeft = (float)blockX;
+            float const blockRight = blockLeft + (float)blockWidth;
+
+            candidates.clear();
+            for (uint32_t segment = 0; segment < segments.size(); ++segment)
+            {
+                if (Overlaps(segments[segment], blockLeft, blockBottom, blockRight, blockTop))
+                    candidates.push_back(segment);
+            }
+
+            if (candidates.empty())
+            {
+                int32_t const windingNumber = EvalWindingNumberKernel<false>(
+                    _outline, blockLeft + sampleOffsets[0], blockTop - sampleOffsets[0], nullptr);
+                uint8_t const value = (windingNumber > 0) ? fullValue : 0u;
+                for (uint32_t y = blockY; y < blockY + blockHeight; ++y)
+                    std::memset(_surface.pixels + y * _surface.stride + blockX, value, blockWidth);
+                continue;
+            }
+
+            for (uint32_t y = blockY; y < blockY + blockHeight; ++y)
+            {
+                uint8_t* const row = _surface.pixels + y * _surface.stride;
+                float const rowTop = (float)(_surface.height - y);
+
+                for (uint32_t x = blockX; x < blockX + blockWidth; ++x)
+                {
+                    float const pixelLeft = (float)x;
+
+                    bool crossed = false;
+                    for (uint32_t segment : candidates)
+                    {
+                        if (Overlaps(segments[segment], pixelLeft, rowTop - 1.f, pixelLeft + 1.f, rowTop))
+                        {
+                            crossed = true;
+                            break;
+                        }
+                    }
+
+                    if (crossed)
+                    {
+                        row[x] = SamplePixel<kSamplingRate, kSubPixelEval>(_outline, sampleOffsets,
+                                                                            pixelLeft, rowTop);
+                    }
+                    else
+                    {
+                        int32_t const windingNumber = EvalWindingNumberKernel<false>(
+                            _outline, pixelLeft + sampleOffsets[0], rowTop - sampleOffsets[0], nullptr);
+                        row[x] = (windingNumber > 0) ? fullValue : 0u;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// _segments must come from BuildSegmentBounds with the SegmentMargin of the sampling mode, or be
+// empty when UsesSegmentBounds is false.
+static void RasterizeOutlineSegments(GlyphOutline const* _outline, std::vector<SegmentBounds> const& _segments,
+                                     uint32_t _samplingRate, bool _subPixelEval, RasterSurface const& _surface,
+                                     std::vector<uint32_t>* _candidates)
+{
+    switch (_samplingRate * 2 + (_subPixelEval ? 1 : 0))
+    {
+    case 0: RasterizeOutlineKernel<0, false>(_outline, _segments, _surface, _candidates); break;
+    case 1: RasterizeOutlineKernel<0, true>(_outline, _segments, _surface, _candidates); break;
+    case 2: RasterizeOutlineKernel<1, false>(_outline, _segments, _surface, _candidates); break;
+    case 3: RasterizeOutlineKernel<1, true>(_outline, _segments, _surface, _candidates); break;
+    case 4: RasterizeOutlineKernel<2, false>(_outline, _segments, _surface, _candidates); break;
+    case 5: RasterizeOutlineKernel<2, true>(_outline, _segments, _surface, _candidates); break;
+    case 6: RasterizeOutlineKernel<3, false>(_outline, _segments, _surface, _candidates); break;
+    case 7: RasterizeOutlineKernel<3, true>(_outline, _segments, _surface, _candidates); break;
+    default: RasterizeOutlineGeneric(_outline, _samplingRate, _subPixelEval, _surface); break;
+    }
+}
+
+void RasterizeOutline(GlyphOutline const* _outline, uint32_t _samplingRate, bool _subPixelEval,
+                      RasterSurface const& _surface)
+{
+    std::vector<SegmentBounds> segments;
+    if (UsesSegmentBounds(_samplingRate, _subPixelEval))
+        BuildSegmentBounds(_outline, SegmentMargin(_samplingRate, _subPixelEval), &segments);
+
+    std::vector<uint32_t> candidates;
+    candidates.reserve(segments.size());
+    RasterizeOutlineSegments(_outline, segments, _samplingRate, _subPixelEval, _surface, &candidates);
+}
+
+// Sizes the bitmap for the glyph at a pixel size and returns the matching outline offset.
+template <typename Bounds>
+static void PlaceCoverageBitmap(Bounds const* _glyph, float _pixelSize, bool _subPixelEval,
+                                CoverageBitmap* _bitmap, float* _offsetX, float* _offsetY)
+{
+    CoverageBitmap& bitmap = *_bitmap;
+
+    // Distance based coverage bleeds half a pixel outside of the outline.
+    int32_t const padding = _subPixelEval ? 1 : 0;
+    int32_t const left = (int32_t)std::floor((float)_glyph->xmin / _pixelSize) - padding;
+    int32_t const right = (int32_t)std::ceil((float)_glyph->xmax / _pixelSize) + padding;
+    int32_t const bottom = (int32_t)std::floor((float)_glyph->ymin / _pixelSize) - padding;
+    int32_t const top = (int32_t)std::ceil((float)_glyph->ymax / _pixelSize) + padding;
+
+    bitmap.left = left;
+    bitmap.top = top;
+    bitmap.width = (uint32_t)(right - left);
+    bitmap.height = (uint32_t)(top - bottom);
+    bitmap.pixels.resize(bitmap.width * bitmap.height);
+
+    *_offsetX = -(float)left;
+    *_offsetY = -(float)bottom;
+}
+
+static inline RasterSurface CoverageSurface(CoverageBitmap& _bitmap)
+{
+    RasterSurface surface{};
+    surface.pixels = _bitmap.pixels.data();
+    surface.width = _bitmap.width;
+    surface.height = _bitmap.height;
+    surface.stride = _bitmap.width;
+    return surface;
+}
+
+static inline void ClearCoverageBitmap(CoverageBitmap* _bitmap)
+{
+    _bitmap->left = _bitmap->top = 0;
+    _bitmap->width = _bitmap->height = 0u;
+    _bitmap->pixels.clear();
+}
+
+void RasterizeGlyph(Glyph const* _glyph, float _pixelSize, uint32_t _samplingRate, bool _subPixelEval,
+                    CoverageBitmap* _bitmap)
+{
+    TTFTK_SCOPED_TIMER(Stage::Rasterize);
+
+    ClearCoverageBitmap(_bitmap);
+    if (_glyph->contours.empty())
+        return;
+
+    float offsetX, offsetY;
+    PlaceCoverageBitmap(_glyph, _pixelSize, _subPixelEval, _bitmap, &offsetX, &offsetY);
+
+    GlyphOutline outline{};
+    float const scale = 1.f / _pixelSize;
+    TransformGlyph(_glyph, scale, scale, offsetX, offsetY, &outline);
+    RasterizeOutline(&outline, _samplingRate, _subPixelEval, CoverageSurface(*_bitmap));
+}
+
+void RasterizeGlyphSizes(Glyph const* _glyph, float const* _pixelSizes, size_t _sizeCount,
+                         uint32_t _samplingRate, bool _subPixelEval, CoverageBitmap* _bitmaps,
+                         uint32_t _mipCount, CoverageBitmap* _mips)
+{
+    TTFTK_SCOPED_TIMER(Stage::Rasterize);
+
+    for (size_t size = 0u; size < _sizeCount; ++size)
+        ClearCoverageBitmap(&_bitmaps[size]);
+    for (uint32_t mip = 0u; mip < _mipCount; ++mip)
+        ClearCoverageBitmap(&_mips[mip]);
+
+    if (_glyph->contours.empty() || _sizeCount == 0u)
+        return;
+
+    // Segment bounds in font units. Scaling is monotonic, so rescaling them gives the same bounds as
+    // measuring the transformed outline.
+    bool const useSegments = UsesSegmentBounds(_samplingRate, _subPixelEval);
+    std::vector<SegmentBounds> glyphSegments;
+    if (useSegments)
+    {
+        for (GlyphContour const& contour : _glyph->contours)
+        {
+            int16_t const* const x = contour.x.data();
+            int16_t const* const y = contour.y.data();
+            for (size_t point = 0u; point + 2 < contour.x.size(); point += 2)
+            {
+                SegmentBounds bounds;
+                bounds.xmin = (float)std::min(x[point], std::min(x[point + 1], x[point + 2]));
+                bounds.xmax = (float)std::max(x[point], std::max(x[point + 1], x[point + 2]));
+                bounds.ymin = (float)std::min(y[point], std::min(y[point + 1], y[point + 2]));
+                bounds.ymax = (float)std::max(y[point], std::max(y[point + 1], y[point + 2]));
+                glyphSegments.push_back(bounds);
+            }
+        }
+    }
+
+    float const margin = SegmentMargin(_samplingRate, _subPixelEval);
+    GlyphOutline outline{};
+    std::vector<SegmentBounds> segments(glyphSegments.size());
+    std::vector<uint32_t> candidates;
+    candidates.reserve(segments.size());
+    size_t largest = 0u;
+
+    for (size_t size = 0u; size < _sizeCount; ++size)
+    {
+        float offsetX, offsetY;
+        PlaceCoverageBitmap(_glyph, _pixelSizes[size], _subPixelEval, &_bitmaps[size], &offsetX, &offsetY);
+
+        float const scale = 1.f / _pixelSizes[size];
+        TransformGlyph(_glyph, scale, scale, offsetX, offsetY, &outline);
+        for (size_t segment = 0u; segment < segments.size(); ++segment)
+        {
+            SegmentBounds const& source = glyphSegments[segment];
+            segments[segment].xmin = (source.xmin * scale + offsetX) - margin;
+            segments[segment].xmax = (source.xmax * scale + offsetX) + margin;
+            segments[segment].ymin = (source.ymin * scale + offsetY) - margin;
+            segments[segment].ymax = (source.ymax * scale + offsetY) + margin;
+        }
+
+        RasterizeOutlineSegments(&outline, segments, _samplingRate, _subPixelEval,
+                                 CoverageSurface(_bitmaps[size]), &candidates);
+
+        if (_pixelSizes[size] < _pixelSizes[largest])
+            largest = size;
+    }
+
+    for (uint32_t mip = 0u; mip < _mipCount; ++mip)
+        DownsampleCoverage((mip == 0u) ? _bitmaps[largest] : _mips[mip - 1], &_mips[mip]);
+}
+
+static inline int32_t FloorHalf(int32_t _value)
+{
+    return (_value - (_value < 0 ? 1 : 0)) / 2;
+}
+
+void DownsampleCoverage(CoverageBitmap const& _source, CoverageBitmap* _target)
+{
+    CoverageBitmap& target = *_target;
+    ClearCoverageBitmap(_target);
+    if (_source.pixels.empty())
+        return;
+
+    int32_t const sourceRight = _source.left + (int32_t)_source.width;
+    int32_t const sourceBottom = _source.top - (int32_t)_source.height;
+    int32_t const left = FloorHalf(_source.left);
+    int32_t const top = -FloorHalf(-_source.top);
+    target.left = left;
+    target.top = top;
+    target.width = (uint32_t)(-FloorHalf(-sourceRight) - left);
+    target.height = (uint32_t)(top - FloorHalf(sourceBottom));
+    target.pixels.resize(target.width * target.height);
+
+    // Source pixels outside of the bitmap count as empty.
+    auto const sourceAt = [&](int32_t _x, int32_t _rowTop) -> uint32_t
+    {
+        if (_x < _source.left || _x >= sourceRight || _rowTop > _source.top || _rowTop <= sourceBottom)
+            return 0u;
+        return _source.pixels[(size_t)(_source.top - _rowTop) * _source.width + (size_t)(_x - _source.left)];
+    };
+
+    for (uint32_t y = 0u; y < target.height; ++y)
+    {
+        int32_t const rowTop = 2 * (top - (int32_t)y);
+        uint8_t* const row = target.pixels.data() + y * target.width;
+        for (uint32_t x = 0u; x < target.width; ++x)
+        {
+            int32_t const sourceX = 2 * (left + (int32_t)x);
+            uint32_t const sum = sourceAt(sourceX, rowTop) + sourceAt(sourceX + 1, rowTop)
+                + sourceAt(sourceX, rowTop - 1) + sourceAt(sourceX + 1, rowTop - 1);
+            row[x] = (uint8_t)((sum + 2u) / 4u);
+        }
+    }
+}
+
+// Squared distance to the closest point of the polyline.
+static float PolylineDistanceSquared(float _x, float _y, float const* _xs, float const* _ys, size_t _count)
+{
+    float best = std::numeric_limits<float>::max();
+    for (size_t point = 0u; point + 1u < _count; ++point)
+    {
+        float const dx = _xs[point + 1] - _xs[point];
+        float const dy = _ys[point + 1] - _ys[point];
+        float const length = dx * dx + dy * dy;
+        float t = (length > 0.f) ? ((_x - _xs[point]) * dx + (_y - _ys[point]) * dy) / length : 0.f;
+        t = std::min(std::max(t, 0.f), 1.f);
+        float const ex = _xs[point] + dx * t - _x;
+        float const ey = _ys[point] + dy * t - _y;
+        best = std::min(best, ex * ex + ey * ey);
+    }
+    return best;
+}
+
+static constexpr uint32_t kSimplifyFlattenSteps = 4u;
+static constexpr uint32_t kSimplifyMaxMerge = 8u;
+
+// Appends the points of the quadratic past its start.
+static void FlattenQuadratic(float _x0, float _y0, float _x1, float _y1, float _x2, float _y2,
+                             uint32_t _steps, std::vector<float>* _xs, std::vector<float>* _ys)
+{
+    for (uint32_t step = 1u; step <= _steps; ++step)
+    {
+        float const t = (float)step / (float)_steps;
+        float const s = 1.f - t;
+        _xs->push_back(s * s * _x0 + 2.f * s * t * _x1 + t * t * _x2);
+        _ys->push_back(s * s * _y0 + 2.f * s * t * _y1 + t * t * _y2);
+    }
+}
+
+// Control point of a single quadratic replacing segments _first to _last of the contour, when it stays
+// within the tolerance of them. A line is tried first, then the curve through the end tangents.
+static bool FitContourSegments(GlyphContour const& _contour, size_t _first, size_t _last, float _tolerance,
+                               int16_t* _controlX, int16_t* _controlY,
+                               std::vector<float>* _sourceX, std::vector<float>* _sourceY,
+                               std::vector<float>* _fitX, std::vector<float>* _fitY)
+{
+    int16_t const* const x = _contour.x.data();
+    int16_t const* const y = _contour.y.data();
+    size_t const begin = _first * 2u;
+    size_t const end = _last * 2u + 2u;
+
+    std::vector<float>& sourceX = *_sourceX;
+    std::vector<float>& sourceY = *_sourceY;
+    sourceX.assign(1u, (float)x[begin]);
+    sourceY.assign(1u, (float)y[begin]);
+    for (size_t point = begin; point < end; point += 2u)
+    {
+        FlattenQuadratic(x[point], y[point], x[point + 1], y[point + 1], x[point + 2], y[point + 2],
+                         kSimplifyFlattenSteps, &sourceX, &sourceY);
+    }
+
+    float const toleranceSquared = _tolerance * _tolerance;
+    auto const fits = [&](int16_t _cx, int16_t _cy)
+    {
+        std::vector<float>& fitX = *_fitX;
+        std::vector<float>& fitY = *_fitY;
+        fitX.assign(1u, (float)x[begin]);
+        fitY.assign(1u, (float)y[begin]);
+        FlattenQuadratic(x[begin], y[begin], _cx, _cy, x[end], y[end],
+                         (uint32_t)(_last - _first + 1u) * kSimplifyFlattenSteps, &fitX, &fitY);
+        for (size_t point = 0u; point < sourceX.size(); ++point)
+        {
+            if (PolylineDistanceSquared(sourceX[point], sourceY[point], fitX.data(), fitY.data(), fitX.size())
+                > toleranceSquared)
+                return false;
+        }
+        for (size_t point = 0u; point < fitX.size(); ++point)
+        {
+            if (PolylineDistanceSquared(fitX[point], fitY[point], sourceX.data(), sourceY.data(), sourceX.size())
+                > toleranceSquared)
+                return false;
+        }
+        *_controlX = _cx;
+        *_controlY = _cy;
+        return true;
+    };
+
+    // Lines get their off point a quarter of the way, same as in ReadGlyphIndexData.
+    if (fits((int16_t)(x[begin] + (x[end] - x[begin]) / 4), (int16_t)(y[begin] + (y[end] - y[begin]) / 4)))
+        return true;
+
+    float startX = (float)(x[begin + 1] - x[begin]);
+    float startY = (float)(y[begin + 1] - y[begin]);
+    if (startX == 0.f && startY == 0.f)
+    {
+        startX = (float)(x[begin + 2] - x[begin]);
+        startY = (float)(y[begin + 2] - y[begin]);
+    }
+    float endX = (float)(x[end] - x[end - 1]);
+    float endY = (float)(y[end] - y[end - 1]);
+    if (endX == 0.f && endY == 0.f)
+    {
+        endX = (float)(x[end] - x[end - 2]);
+        endY = (float)(y[end] - y[end - 2]);
+    }
+
+    // start + s * startDir = end - u * endDir, both s and u have to be positive.
+    float const chordX = (float)(x[end] - x[begin]);
+    float const chordY = (float)(y[end] - y[begin]);
+    float const cross = startX * endY - startY * endX;
+    if (std::abs(cross) < 1e-6f * (startX * startX + startY * startY) * (endX * endX + endY * endY))
+        return false;
+    float const s = (chordX * endY - chordY * endX) / cross;
+    float const u = (chordX * startY - chordY * startX) / cross;
+    if (!(s > 0.f && u > 0.f))
+        return false;
+
+    float const controlX = std::round((float)x[begin] + s * startX);
+    float const controlY = std::round((float)y[begin] + s * startY);
+    if (std::abs(controlX) > 32767.f || std::abs(controlY) > 32767.f)
+        return false;
+    return fits((int16_t)controlX, (int16_t)controlY);
+}
+
+void SimplifyGlyph(Glyph const* _glyph, float _tolerance, Glyph* _simplified)
+{
+    Glyph& simplified = *_simplified;
+    simplified.xmin = _glyph->xmin;
+    simplified.ymin = _glyph->ymin;
+    simplified.xmax = _glyph->xmax;
+    simplified.ymax = _glyph->ymax;
+    simplified.contours.resize(_glyph->contours.size());
+
+    std::vector<float> sourceX, sourceY, fitX, fitY;
+    for (size_t contourIndex = 0u; contourIndex < _glyph->contours.size(); ++contourIndex)
+    {
+        GlyphContour const& contour = _glyph->contours[contourIndex];
+        GlyphContour& output = simplified.contours[contourIndex];
+        size_t const segmentCount = contour.x.size() / 2u;
+        if (segmentCount < 3u)
+        {
+            output = contour;
+            continue;
+        }
+
+        output.x.assign(1u, contour.x[0]);
+        output.y.assign(1u, contour.y[0]);
+        for (size_t first = 0u; first < segmentCount;)
+        {
+            // The first run leaves at least one segment so that the contour cannot collapse.
+            size_t last = first;
+            size_t const lastLimit = std::min(first + kSimplifyMaxMerge - 1u,
+                                              segmentCount - ((first == 0u) ? 2u : 1u));
+            int16_t controlX = contour.x[first * 2u + 1u];
+            int16_t controlY = contour.y[first * 2u + 1u];
+            for (size_t candidate = first + 1u; candidate <= lastLimit; ++candidate)
+            {
+                int16_t fitControlX, fitControlY;
+                if (!FitContourSegments(contour, first, candidate, _tolerance, &fitControlX, &fitControlY,
+                                        &sourceX, &sourceY, &fitX, &fitY))
+                    break;
+                last = candidate;
+                controlX = fitControlX;
+                controlY = fitControlY;
+            }
+
+            output.x.push_back(controlX);
+            output.y.push_back(controlY);
+            output.x.push_back(contour.x[last * 2u + 2u]);
+            output.y.push_back(contour.y[last * 2u + 2u]);
+            first = last + 1u;
+        }
+    }
+}
+
+void BuildGlyphLevels(Glyph const* _glyph, float _tolerance, uint32_t _levelCount, GlyphLevels* _levels)
+{
+    GlyphLevels& levels = *_levels;
+    levels.full = *_glyph;
+    levels.levels.resize(_levelCount);
+    levels.tolerances.resize(_levelCount);
+
+    // Each level simplifies the previous one with the tolerance left over, so the error stays bounded
+    // by the level's tolerance while the later passes only see the already reduced outline.
+    float tolerance = _tolerance;
+    float spent = 0.f;
+    for (uint32_t level = 0u; level < _levelCount; ++level)
+    {
+        Glyph const& source = (level == 0u) ? levels.full : levels.levels[level - 1u];
+        SimplifyGlyph(&source, tolerance - spent, &levels.levels[level]);
+        levels.tolerances[level] = tolerance;
+        spent = tolerance;
+        tolerance *= 2.f;
+    }
+}
+
+Glyph const* SelectGlyphLevel(GlyphLevels const& _levels, float _pixelSize, float _pixelTolerance)
+{
+    float const tolerance = _pixelSize * _pixelTolerance;
+    Glyph const* glyph = &_levels.full;
+    for (size_t level = 0u; level < _levels.levels.size() && _levels.tolerances[level] <= tolerance; ++level)
+        glyph = &_levels.levels[level];
+    return glyph;
+}
+
+CoverageError MeasureCoverageError(CoverageBitmap const& _reference, CoverageBitmap const& _bitmap)
+{
+    CoverageError error{ 0.f, 0.f };
+    if (_reference.pixels.empty() && _bitmap.pixels.empty())
+        return error;
+
+    auto const coverageAt = [](CoverageBitmap const& _source, int32_t _x, int32_t _rowTop) -> int32_t
+    {
+        if (_source.pixels.empty() || _x < _source.left || _x >= _source.left + (int32_t)_source.width
+            || _rowTop > _source.top || _rowTop <= _source.top - (int32_t)_source.height)
+            return 0;
+        return _source.pixels[(size_t)(_source.top - _rowTop) * _source.width + (size_t)(_x - _source.left)];
+    };
+
+    int32_t left = std::numeric_limits<int32_t>::max(), right = std::numeric_limits<int32_t>::min();
+    int32_t top = std::numeric_limits<int32_t>::min(), bottom = std::numeric_limits<int32_t>::max();
+    for (CoverageBitmap const* source : { &_reference, &_bitmap })
+    {
+        if (source->pixels.empty())
+            continue;
+        left = std::min(left, source->left);
+        right = std::max(right, source->left + (int32_t)source->width);
+        top = std::max(top, source->top);
+        bottom = std::min(bottom, source->top - (int32_t)source->height);
+    }
+
+    uint64_t sum = 0u;
+    int32_t largest = 0;
+    for (int32_t rowTop = top; rowTop > bottom; --rowTop)
+    {
+        for (int32_t x = left; x < right; ++x)
+        {
+            int32_t const difference = std::abs(coverageAt(_reference, x, rowTop) - coverageAt(_bitmap, x, rowTop));
+            sum += (uint64_t)difference;
+            largest = std::max(largest, difference);
+        }
+    }
+
+    error.mean = (float)sum / (255.f * (float)((int64_t)(right - left) * (top - bottom)));
+    error.max = (float)largest / 255.f;
+    return error;
+}
+
+static inline int64_t MeshCross(int32_t _ax, int32_t _ay, int32_t _bx, int32_t _by, int32_t _cx, int32_t _cy)
+{
+    return (int64_t)(_bx - _ax) * (_cy - _ay) - (int64_t)(_by - _ay) * (_cx - _ax);
+}
+
+void BuildGlyphMesh(Glyph const* _glyph, GlyphMesh* _mesh)
+{
+    GlyphMesh& mesh = *_mesh;
+    mesh.xmin = _glyph->xmin;
+    mesh.ymin = _glyph->ymin;
+    mesh.xmax = _glyph->xmax;
+    mesh.ymax = _glyph->ymax;
+    mesh.vertices.clear();
+    mesh.indices.clear();
+
+    std::vector<uint32_t> curveIndices{};
+    for (GlyphContour const& contour : _glyph->contours)
+    {
+        if (contour.x.size() < 3u)
+            continue;
+
+        int16_t const* const x = contour.x.data();
+        int16_t const* const y = contour.y.data();
+        uint32_t const anchor = (uint32_t)mesh.vertices.size();
+        mesh.vertices.push_back(MeshVertex{ x[0], y[0], 0u, 2u });
+        uint32_t previous = anchor;
+
+        for (size_t point = 0u; point + 2 < contour.x.size(); point += 2)
+        {
+            // Chords starting or ending on the anchor add nothing to the fan.
+            uint32_t next = anchor;
+            if (x[point + 2] != x[0] || y[point + 2] != y[0])
+            {
+                next = (uint32_t)mesh.vertices.size();
+                mesh.vertices.push_back(MeshVertex{ x[point + 2], y[point + 2], 0u, 2u });
+            }
+            if (MeshCross(x[0], y[0], x[point], y[point], x[point + 2], y[point + 2]) != 0)
+            {
+                mesh.indices.push_back(anchor);
+                mesh.indices.push_back(previous);
+                mesh.indices.push_back(next);
+            }
+            previous = next;
+
+            // Straight segments have collinear control points.
+            if (MeshCross(x[point], y[point], x[point + 1], y[point + 1], x[point + 2], y[point + 2]) != 0)
+            {
+                uint32_t const first = (uint32_t)mesh.vertices.size();
+                mesh.vertices.push_back(MeshVertex{ x[point], y[point], 0u, 0u });
+                mesh.vertices.push_back(MeshVertex{ x[point + 1], y[point + 1], 1u, 0u });
+                mesh.vertices.push_back(MeshVertex{ x[point + 2], y[point + 2], 2u, 2u });
+                curveIndices.push_back(first);
+                curveIndices.push_back(first + 1u);
+                curveIndices.push_back(first + 2u);
+            }
+        }
+    }
+
+    mesh.curveIndexOffset = (uint32_t)mesh.indices.size();
+    mesh.indices.insert(mesh.indices.end(), curveIndices.begin(), curveIndices.end());
+}
+
+void CreateGlyphMeshCache(TrueTypeFile const& _ttfFile, GlyphMeshCache* _cache)
+{
+    _cache->ttfFile = &_ttfFile;
+    _cache->meshes.clear();
+    _cache->meshes.resize(_ttfFile.glyphCount);
+    _cache->built.assign(_ttfFile.glyphCount, 0u);
+}
+
+Result GetGlyphMesh(GlyphMeshCache* _cache, uint32_t _glyphIndex, GlyphMesh const** _mesh)
+{
+    GlyphMeshCache& cache = *_cache;
+    if (_glyphIndex >= cache.meshes.size())
+        return Result::GlyphMissing;
+
+    if (!cache.built[_glyphIndex])
+    {
+        Glyph glyph{};
+        Result const result = ReadGlyphIndexData(*cache.ttfFile, _glyphIndex, &glyph);
+        if (result != Result::Success)
+            return result;
+        BuildGlyphMesh(&glyph, &cache.meshes[_glyphIndex]);
+        cache.built[_glyphIndex] = 1u;
+    }
+
+    *_mesh = &cache.meshes[_glyphIndex];
+    return Result::Success;
+}
+
+void RasterizeGlyphMesh(GlyphMesh const& _mesh, float _pixelSize, uint32_t _samplingRate,
+                        CoverageBitmap* _bitmap)
+{
+    ClearCoverageBitmap(_bitmap);
+    if (_mesh.indices.empty())
+        return;
+
+    float offsetX, offsetY;
+    PlaceCoverageBitmap(&_mesh, _pixelSize, false, _bitmap, &offsetX, &offsetY);
+    CoverageBitmap& bitmap = *_bitmap;
+
+    uint32_t const side = 1u << _samplingRate;
+    uint32_t const sampleCount = side * side;
+    float const sampleSize = 1.f / (float)side;
+    uint32_t const samplesX = bitmap.width * side;
+    uint32_t const samplesY = bitmap.height * side;
+    std::vector<int32_t> windingNumbers((size_t)samplesX * samplesY, 0);
+
+    // Sample (i, j) sits at ((i + 0.5) / side, height - (j + 0.5) / side) in pixel space, as in
+    // RasterizeOutlineGeneric. Shared edges follow a top left fill rule so they are counted once.
+    float const scale = 1.f / _pixelSize;
+    for (size_t index = 0u; index < _mesh.indices.size(); index += 3)
+    {
+        bool const curve = index >= _mesh.curveIndexOffset;
+        MeshVertex const* corners[3] = {
+            &_mesh.vertices[_mesh.indices[index]],
+            &_mesh.vertices[_mesh.indices[index + 1]],
+            &_mesh.vertices[_mesh.indices[index + 2]],
+        };
+        int64_t const cross = MeshCross(corners[0]->x, corners[0]->y, corners[1]->x, corners[1]->y,
+                                        corners[2]->x, corners[2]->y);
+        if (cross == 0)
+            continue;
+
+        int32_t const sign = (cross < 0) ? 1 : -1;
+        if (cross < 0)
+            std::swap(corners[1], corners[2]);
+
+        float px[3], py[3];
+        for (uint32_t corner = 0u; corner < 3u; ++corner)
+        {
+            px[corner] = (float)corners[corner]->x * scale + offsetX;
+            py[corner] = (float)corners[corner]->y * scale + offsetY;
+        }
+
+        float const area = (px[1] - px[0]) * (py[2] - py[0]) - (py[1] - py[0]) * (px[2] - px[0]);
+        if (area <= 0.f)
+            continue;
+
+        int32_t const beginI = std::max(0, (int32_t)std::floor(std::min(px[0], std::min(px[1], px[2])) * (float)side));
+        int32_t const endI = std::min((int32_t)samplesX,
+                                      (int32_t)std::ceil(std::max(px[0], std::max(px[1], px[2])) * (float)side) + 1);
+        float const height = (float)bitmap.height;
+        int32_t const beginJ = std::max(0, (int32_t)std::floor((height - std::max(py[0], std::max(py[1], py[2]))) * (float)side));
+        int32_t const endJ = std::min((int32_t)samplesY,
+                                      (int32_t)std::ceil((height - std::min(py[0], std::min(py[1], py[2]))) * (float)side) + 1);
+
+        for (int32_t j = beginJ; j < endJ; ++j)
+        {
+            float const sampleY = height - ((float)j + 0.5f) * sampleSize;
+            for (int32_t i = beginI; i < endI; ++i)
+            {
+                float const sampleX = ((float)i + 0.5f) * sampleSize;
+
+                float weights[3];
+                bool inside = true;
+                for (uint32_t edge = 0u; edge < 3u && inside; ++edge)
+                {
+                    uint32_t const a = (edge + 1u) % 3u;
+                    uint32_t const b = (edge + 2u) % 3u;
+                    float const dx = px[b] - px[a];
+                    float const dy = py[b] - py[a];
+                    weights[edge] = dx * (sampleY - py[a]) - dy * (sampleX - px[a]);
+                    bool const topLeft = (dy < 0.f) || (dy == 0.f && dx < 0.f);
+                    inside = (weights[edge] > 0.f) || (weights[edge] == 0.f && topLeft);
+                }
+                if (!inside)
+                    continue;
+
+                if (curve)
+                {
+                    float u = 0.f;
+                    float v = 0.f;
+                    for (uint32_t corner = 0u; corner < 3u; ++corner)
+                    {
+                        u += weights[corner] * (float)corners[corner]->u * 0.5f;
+                        v += weights[corner] * (float)corners[corner]->v * 0.5f;
+                    }
+                    u /= area;
+                    v /= area;
+                    if (u * u - v >= 0.f)
+                        continue;
+                }
+
+                windingNumbers[(size_t)j * samplesX + (size_t)i] += sign;
+            }
+        }
+    }
+
+    for (uint32_t y = 0u; y < bitmap.height; ++y)
+    {
+        for (uint32_t x = 0u; x < bitmap.width; ++x)
+        {
+            float accum = 0.f;
+            for (uint32_t sy = 0u; sy < side; ++sy)
+            {
+                int32_t const* const row = windingNumbers.data() + (size_t)(y * side + sy) * samplesX + x * side;
+                for (uint32_t sx = 0u; sx < side; ++sx)
+                    accum += (255.f * ((row[sx] > 0) ? 1.f : 0.f)) / (float)sampleCount;
+            }
+            bitmap.pixels[(size_t)y * bitmap.width + x] = (uint8_t)std::round(accum);
+        }
+    }
+}
+
+Result RenderTextRun(TrueTypeFile const& _ttfFile, TextRun const& _run,
+                     float _pixelSize, uint32_t _samplingRate, bool _subPixelEval,
+                     RasterSurface const& _surface, int32_t _originX, int32_t _baselineY,
+                     RenderScratch* _scratch)
+{
+    std::vector<Glyph>& glyphs = _scratch->glyphs;
+    std::vector<CoverageBitmap>& bitmaps = _scratch->bitmaps;
+
+    size_t const uniqueCount = _run.glyphIndices.size();
+    if (glyphs.size() < uniqueCount)
+        glyphs.resize(uniqueCount);
+    if (bitmaps.size() < uniqueCount)
+        bitmaps.resize(uniqueCount);
+
+    for (size_t index = 0u; index < uniqueCount; ++index)
+    {
+        Glyph& glyph = glyphs[index];
+        if (ReadGlyphIndexData(_ttfFile, _run.glyphIndices[index], &glyph) != Result::Success)
+            glyph.contours.clear();
+        RasterizeGlyph(&glyph, _pixelSize, _samplingRate, _subPixelEval, &bitmaps[index]);
+    }
+
+    for (GlyphPlacement const& placement : _run.placements)
+    {
+        Glyph const& glyph = glyphs[placement.uniqueIndex];
+        CoverageBitmap const& bitmap = bitmaps[placement.uniqueIndex];
+
+        // The outline is positioned so that its xmin lands on the hmtx left side bearing.
+        int32_t const glyphX = placement.penX + placement.metrics.leftSideBearing - glyph.xmin;
+        int32_t const dstX = _originX + (int32_t)std::lround((float)glyphX / _pixelSize) + bitmap.left;
+        int32_t const dstY = _baselineY - bitmap.top;
+
+        int32_t const beginX = std::max(dstX, 0);
+        int32_t const endX = std::min(dstX + (int32_t)bitmap.width, (int32_t)_surface.width);
+        int32_t const beginY = std::max(dstY, 0);
+        int32_t const endY = std::min(dstY + (int32_t)bitmap.height, (int32_t)_surface.height);
+
+        for (int32_t y = beginY; y < endY; ++y)
+        {
+            uint8_t const* src = bitmap.pixels.data() + (y - dstY) * bitmap.width - dstX;
+            uint8_t* dst = _surface.pixels + y * _surface.stride;
+            for (int32_t x = beginX; x < endX; ++x)
+                dst[x] = (uint8_t)std::min(255u, (uint32_t)dst[x] + (uint32_t)src[x]);
+        }
+    }
+
+    return Result::Success;
+}
+
+// Rounded division by 255, exact for every product of two bytes.
+static inline uint8_t Div255(uint32_t _value)
+{
+    return (uint8_t)((_value + 128u + ((_value + 128u) >> 8)) >> 8);
+}
+
+static inline uint8_t BlendChannel(uint8_t _target, uint8_t _color, uint8_t _alpha)
+{
+    return Div255((uint32_t)_target * (255u - _alpha) + (uint32_t)_color * _alpha);
+}
+
+template <uint32_t kChannels>
+static inline void CompositeRowScalar(uint8_t* _target, uint8_t const* _coverage, uint32_t _count,
+                                      uint8_t const* _channels, uint8_t _alpha)
+{
+    for (uint32_t x = 0u; x < _count; ++x)
+    {
+        uint8_t const alpha = Div255((uint32_t)_coverage[x] * _alpha);
+        for (uint32_t channel = 0u; channel < kChannels; ++channel)
+        {
+            uint8_t& target = _target[x * kChannels + channel];
+            target = BlendChannel(target, _channels[channel], alpha);
+        }
+    }
+}
+
+#ifdef TTFTK_SSE2
+// Same arithmetic as Div255 and BlendChannel on 16 bit lanes, products of bytes fit unsigned.
+static inline __m128i Div255Epi16(__m128i _value)
+{
+    __m128i const biased = _mm_add_epi16(_value, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(biased, _mm_srli_epi16(biased, 8)), 8);
+}
+
+static inline __m128i ScaleCoverage(__m128i _coverage, __m128i _alpha)
+{
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const low = Div255Epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(_coverage, zero), _alpha));
+    __m128i const high = Div255Epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(_coverage, zero), _alpha));
+    return _mm_packus_epi16(low, high);
+}
+
+static inline __m128i BlendBytes(__m128i _target, __m128i _color, __m128i _alpha)
+{
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const full = _mm_set1_epi16(255);
+    __m128i const alphaLow = _mm_unpacklo_epi8(_alpha, zero);
+    __m128i const alphaHigh = _mm_unpackhi_epi8(_alpha, zero);
+    __m128i const low = Div255Epi16(_mm_add_epi16(
+        _mm_mullo_epi16(_mm_unpacklo_epi8(_target, zero), _mm_sub_epi16(full, alphaLow)),
+        _mm_mullo_epi16(_mm_unpacklo_epi8(_color, zero), alphaLow)));
+    __m128i const high = Div255Epi16(_mm_add_epi16(
+        _mm_mullo_epi16(_mm_unpackhi_epi8(_target, zero), _mm_sub_epi16(full, alphaHigh)),
+        _mm_mullo_epi16(_mm_unpackhi_epi8(_color, zero), alphaHigh)));
+    return _mm_packus_epi16(low, high);
+}
+#endif
+
+#ifdef TTFTK_AVX2
+static inline __m256i Div255Epi16(__m256i _value)
+{
+    __m256i const biased = _mm256_add_epi16(_value, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(biased, _mm256_srli_epi16(biased, 8)), 8);
+}
+
+static inline __m256i ScaleCoverage(__m256i _coverage, __m256i _alpha)
+{
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i const low = Div255Epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(_coverage, zero), _alpha));
+    __m256i const high = Div255Epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(_coverage, zero), _alpha));
+    return _mm256_packus_epi16(low, high);
+}
+
+static inline __m256i BlendBytes(__m256i _target, __m256i _color, __m256i _alpha)
+{
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i const full = _mm256_set1_epi16(255);
+    __m256i const alphaLow = _mm256_unpacklo_epi8(_alpha, zero);
+    __m256i const alphaHigh = _mm256_unpackhi_epi8(_alpha, zero);
+    __m256i const low = Div255Epi16(_mm256_add_epi16(
+        _mm256_mullo_epi16(_mm256_unpacklo_epi8(_target, zero), _mm256_sub_epi16(full, alphaLow)),
+        _mm256_mullo_epi16(_mm256_unpacklo_epi8(_color, zero), alphaLow)));
+    __m256i const high = Div255Epi16(_mm256_add_epi16(
+        _mm256_mullo_epi16(_mm256_unpackhi_epi8(_target, zero), _mm256_sub_epi16(full, alphaHigh)),
+        _mm256_mullo_epi16(_mm256_unpackhi_epi8(_color, zero), alphaHigh)));
+    return _mm256_packus_epi16(low, high);
+}
+#endif
+
+static void CompositeRowGray(uint8_t* _target, uint8_t const* _coverage, uint32_t _count,
+                             uint8_t const* _channels, uint8_t _alpha)
+{
+    uint32_t x = 0u;
+#ifdef TTFTK_AVX2
+    __m256i const color256 = _mm256_set1_epi8((char)_channels[0]);
+    __m256i const alpha256 = _mm256_set1_epi16(_alpha);
+    for (; x + 32u <= _count; x += 32u)
+    {
+        __m256i const alpha = ScaleCoverage(_mm256_loadu_si256((__m256i const*)(_coverage + x)), alpha256);
+        __m256i const target = _mm256_loadu_si256((__m256i const*)(_target + x));
+        _mm256_storeu_si256((__m256i*)(_target + x), BlendBytes(target, color256, alpha));
+    }
+#endif
+#ifdef TTFTK_SSE2
+    __m128i const color128 = _mm_set1_epi8((char)_channels[0]);
+    __m128i const alpha128 = _mm_set1_epi16(_alpha);
+    for (; x + 16u <= _count; x += 16u)
+    {
+        __m128i const alpha = ScaleCoverage(_mm_loadu_si128((__m128i const*)(_coverage + x)), alpha128);
+        __m128i const target = _mm_loadu_si128((__m128i const*)(_target + x));
+        _mm_storeu_si128((__m128i*)(_target + x), BlendBytes(target, color128, alpha));
+    }
+#endif
+    CompositeRowScalar<1>(_target + x, _coverage + x, _count - x, _channels, _alpha);
+}
+
+static void CompositeRowRGB(uint8_t* _target, uint8_t const* _coverage, uint32_t _count,
+                            uint8_t const* _channels, uint8_t _alpha)
+{
+    uint32_t x = 0u;
+#if defined(TTFTK_SSE2) && defined(TTFTK_SSSE3)
+    // Sixteen pixels span three registers, the coverage of each pixel is shuffled to its channels.
+    __m128i const expand0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    __m128i const expand1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+    __m128i const expand2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+    uint8_t colorBytes[48];
+    for (uint32_t index = 0u; index < 48u; ++index)
+        colorBytes[index] = _channels[index % 3u];
+    __m128i const color0 = _mm_loadu_si128((__m128i const*)colorBytes);
+    __m128i const color1 = _mm_loadu_si128((__m128i const*)(colorBytes + 16));
+    __m128i const color2 = _mm_loadu_si128((__m128i const*)(colorBytes + 32));
+    __m128i const alpha128 = _mm_set1_epi16(_alpha);
+    for (; x + 16u <= _count; x += 16u)
+    {
+        __m128i const alpha = ScaleCoverage(_mm_loadu_si128((__m128i const*)(_coverage + x)), alpha128);
+        __m128i* const target = (__m128i*)(_target + x * 3u);
+        _mm_storeu_si128(target + 0, BlendBytes(_mm_loadu_si128(target + 0), color0, _mm_shuffle_epi8(alpha, expand0)));
+        _mm_storeu_si128(target + 1, BlendBytes(_mm_loadu_si128(target + 1), color1, _mm_shuffle_epi8(alpha, expand1)));
+        _mm_storeu_si128(target + 2, BlendBytes(_mm_loadu_si128(target + 2), color2, _mm_shuffle_epi8(alpha, expand2)));
+    }
+#endif
+    CompositeRowScalar<3>(_target + x * 3u, _coverage + x, _count - x, _channels, _alpha);
+}
+
+static void CompositeRowRGBA(uint8_t* _target, uint8_t const* _coverage, uint32_t _count,
+                             uint8_t const* _channels, uint8_t _alpha)
+{
+    uint32_t x = 0u;
+    uint32_t pixel;
+    std::memcpy(&pixel, _channels, 4u);
+#ifdef TTFTK_AVX2
+    // Unpacks stay within 128 bit lanes, the permutes put the pixels back in order.
+    __m256i const color256 = _mm256_set1_epi32((int)pixel);
+    __m256i const alpha256 = _mm256_set1_epi16(_alpha);
+    for (; x + 32u <= _count; x += 32u)
+    {
+        __m256i const alpha = ScaleCoverage(_mm256_loadu_si256((__m256i const*)(_coverage + x)), alpha256);
+        __m256i const pairsLow = _mm256_unpacklo_epi8(alpha, alpha);
+        __m256i const pairsHigh = _mm256_unpackhi_epi8(alpha, alpha);
+        __m256i const quads0 = _mm256_unpacklo_epi16(pairsLow, pairsLow);
+        __m256i const quads1 = _mm256_unpackhi_epi16(pairsLow, pairsLow);
+        __m256i const quads2 = _mm256_unpacklo_epi16(pairsHigh, pairsHigh);
+        __m256i const quads3 = _mm256_unpackhi_epi16(pairsHigh, pairsHigh);
+        __m256i const alphas[4] = {
+            _mm256_permute2x128_si256(quads0, quads1, 0x20),
+            _mm256_permute2x128_si256(quads2, quads3, 0x20),
+            _mm256_permute2x128_si256(quads0, quads1, 0x31),
+            _mm256_permute2x128_si256(quads2, quads3, 0x31),
+        };
+        __m256i* const target = (__m256i*)(_target + x * 4u);
+        for (uint32_t step = 0u; step < 4u; ++step)
+            _mm256_storeu_si256(target + step, BlendBytes(_mm256_loadu_si256(target + step), color256, alphas[step]));
+    }
+#endif
+#ifdef TTFTK_SSE2
+    __m128i const color128 = _mm_set1_epi32((int)pixel);
+    __m128i const alpha128 = _mm_set1_epi16(_alpha);
+    for (; x + 16u <= _count; x += 16u)
+    {
+        __m128i const alpha = ScaleCoverage(_mm_loadu_si128((__m128i const*)(_coverage + x)), alpha128);
+        __m128i const pairsLow = _mm_unpacklo_epi8(alpha, alpha);
+        __m128i const pairsHigh = _mm_unpackhi_epi8(alpha, alpha);
+        __m128i const alphas[4] = {
+            _mm_unpacklo_epi16(pairsLow, pairsLow),
+            _mm_unpackhi_epi16(pairsLow, pairsLow),
+            _mm_unpacklo_epi16(pairsHigh, pairsHigh),
+            _mm_unpackhi_epi16(pairsHigh, pairsHigh),
+        };
+        __m128i* const target = (__m128i*)(_target + x * 4u);
+        for (uint32_t step = 0u; step < 4u; ++step)
+            _mm_storeu_si128(target + step, BlendBytes(_mm_loadu_si128(target + step), color128, alphas[step]));
+    }
+#endif
+    CompositeRowScalar<4>(_target + x * 4u, _coverage + x, _count - x, _channels, _alpha);
+}
+
+void CompositeCoverage(uint8_t const* _coverage, uint32_t _width, uint32_t _height, uint32_t _stride,
+                       ColorSurface const& _surface, int32_t _x, int32_t _y, Color _color)
+{
+    int32_t const beginX = std::max(_x, 0);
+    int32_t const endX = (int32_t)std::min<int64_t>((int64_t)_x + _width, (int64_t)_surface.width);
+    int32_t const beginY = std::max(_y, 0);
+    int32_t const endY = (int32_t)std::min<int64_t>((int64_t)_y + _height, (int64_t)_surface.height);
+    if (beginX >= endX || beginY >= endY)
+        return;
+
+    uint8_t const luma = (uint8_t)((_color.r * 77u + _color.g * 150u + _color.b * 29u + 128u) >> 8);
+    uint8_t const channels[4] = {
+        (_surface.format == PixelFormat::Gray8) ? luma : _color.r, _color.g, _color.b, 255u
+    };
+    uint32_t const channelCount = (_surface.format == PixelFormat::Gray8) ? 1u
+        : (_surface.format == PixelFormat::RGB8) ? 3u : 4u;
+    uint32_t const count = (uint32_t)(endX - beginX);
+
+    for (int32_t y = beginY; y < endY; ++y)
+    {
+        uint8_t const* const coverage = _coverage + (size_t)(y - _y) * _stride + (beginX - _x);
+        uint8_t* const target = _surface.pixels + (size_t)y * _surface.stride + (size_t)beginX * channelCount;
+        switch (_surface.format)
+        {
+        case PixelFormat::Gray8: CompositeRowGray(target, coverage, count, channels, _color.a); break;
+        case PixelFormat::RGB8: CompositeRowRGB(target, coverage, count, channels, _color.a); break;
+        case PixelFormat::RGBA8: CompositeRowRGBA(target, coverage, count, channels, _color.a); break;
+        }
+    }
+}
+
+void CompositeCoverage(CoverageBitmap const& _bitmap, ColorSurface const& _surface, int32_t _x, int32_t _y,
+                       Color _color)
+{
+    CompositeCoverage(_bitmap.pixels.data(), _bitmap.width, _bitmap.height, _bitmap.width, _surface, _x, _y,
+                      _color);
+}
+
+void CreateGlyphAtlas(TrueTypeFile const& _ttfFile, float _pixelSize, uint32_t _samplingRate,
+                      bool _subPixelEval, uint32_t _width, uint32_t _height, GlyphAtlas* _atlas)
+{
+    GlyphAtlas& atlas = *_atlas;
+    atlas.ttfFile = &_ttfFile;
+    atlas.pixelSize = _pixelSize;
+    atlas.samplingRate = _samplingRate;
+    atlas.subPixelEval = _subPixelEval;
+    atlas.width = _width;
+    atlas.height = _height;
+    atlas.generation = 0u;
+    atlas.frame = 0u;
+    atlas.pixels.assign((size_t)_width * _height, 0u);
+    atlas.entries.clear();
+    atlas.glyphEntries.assign(_ttfFile.glyphCount, kAtlasNoEntry);
+    atlas.freeEntries.clear();
+    atlas.shares.clear();
+    uint32_t bucketCount = 16u;
+    while (bucketCount * 4u < _ttfFile.glyphCount)
+        bucketCount <<= 1;
+    atlas.shareBuckets.assign(bucketCount, kAtlasNoEntry);
+    atlas.shelves.clear();
+    atlas.dirtyRects.clear();
+}
+
+void BeginAtlasFrame(GlyphAtlas* _atlas)
+{
+    ++_atlas->frame;
+}
+
+// Prefers the lowest shelf at most twice as tall as the slot, taller shelves are only used once no
+// new shelf fits.
+static bool AllocateShelfSlot(GlyphAtlas& _atlas, uint32_t _width, uint32_t _height, AtlasRect* _slot)
+{
+    if (_width > _atlas.width || _height > _atlas.height)
+        return false;
+
+    AtlasShelf* best = nullptr;
+    AtlasShelf* fallback = nullptr;
+    for (AtlasShelf& shelf : _atlas.shelves)
+    {
+        if (shelf.height < _height || _atlas.width - shelf.usedWidth < _width)
+            continue;
+        if (shelf.height <= _height * 2u && (!best || shelf.height < best->height))
+            best = &shelf;
+        if (!fallback || shelf.height < fallback->height)
+            fallback = &shelf;
+    }
+
+    if (!best)
+    {
+        uint32_t const shelfY = _atlas.shelves.empty()
+            ? 0u : _atlas.shelves.back().y + _atlas.shelves.back().height;
+        if (_atlas.height - shelfY >= _height)
+        {
+            _atlas.shelves.push_back(AtlasShelf{ shelfY, _height, 0u });
+            best = &_atlas.shelves.back();
+        }
+        else
+        {
+            best = fallback;
+        }
+    }
+
+    if (!best)
+        return false;
+
+    *_slot = AtlasRect{ best->usedWidth, best->y, _width, _height };
+    best->usedWidth += _width;
+    return true;
+}
+
+static uint32_t ReuseFreeSlot(GlyphAtlas& _atlas, uint32_t _width, uint32_t _height)
+{
+    size_t bestFree = _atlas.freeEntries.size();
+    uint64_t bestArea = ~0ull;
+    for (size_t index = 0u; index < _atlas.freeEntries.size(); ++index)
+    {
+        AtlasRect const& slot = _atlas.entries[_atlas.freeEntries[index]].slot;
+        uint64_t const area = (uint64_t)slot.width * slot.height;
+        if (slot.width >= _width && slot.height >= _height && area < bestArea)
+        {
+            bestFree = index;
+            bestArea = area;
+        }
+    }
+
+    if (bestFree == _atlas.freeEntries.size())
+        return kAtlasNoEntry;
+
+    uint32_t const entry = _atlas.freeEntries[bestFree];
+    _atlas.freeEntries[bestFree] = _atlas.freeEntries.back();
+    _atlas.freeEntries.pop_back();
+    return entry;
+}
+
+// Entries evicted without a slot of their own are reused by glyphs that need none, empty or shared.
+static uint32_t ReuseSlotlessEntry(GlyphAtlas& _atlas)
+{
+    for (size_t index = 0u; index < _atlas.freeEntries.size(); ++index)
+    {
+        uint32_t const entry = _atlas.freeEntries[index];
+        if (_atlas.entries[entry].slot.width != 0u)
+            continue;
+
+        _atlas.freeEntries[index] = _atlas.freeEntries.back();
+        _atlas.freeEntries.pop_back();
+        return entry;
+    }
+    return kAtlasNoEntry;
+}
+
+static void CopyAtlasRect(GlyphAtlas& _atlas, AtlasRect const& _target, uint8_t const* _source, uint32_t _stride)
+{
+    for (uint32_t y = 0u; y < _target.height; ++y)
+    {
+        std::memcpy(_atlas.pixels.data() + (size_t)(_target.y + y) * _atlas.width + _target.x,
+                    _source + (size_t)y * _stride, _target.width);
+    }
+}
+
+static void ClearAtlasRect(GlyphAtlas& _atlas, AtlasRect const& _target)
+{
+    for (uint32_t y = 0u; y < _target.height; ++y)
+        std::memset(_atlas.pixels.data() + (size_t)(_target.y + y) * _atlas.width + _target.x, 0, _target.width);
+}
+
+// Owner whose pixels equal the bitmap, kAtlasNoEntry when there is none.
+static uint32_t FindSharedCoverage(GlyphAtlas const& _atlas, CoverageBitmap const& _bitmap, uint32_t _hash)
+{
+    uint32_t owner = _atlas.shareBuckets[_hash & (uint32_t)(_atlas.shareBuckets.size() - 1u)];
+    for (; owner != kAtlasNoEntry; owner = _atlas.shares[owner].nextOwner)
+    {
+        AtlasRect const& rect = _atlas.entries[owner].rect;
+        if (_atlas.shares[owner].hash != _hash || rect.width != _bitmap.width || rect.height != _bitmap.height)
+            continue;
+
+        bool equal = true;
+        for (uint32_t y = 0u; y < rect.height && equal; ++y)
+        {
+            equal = std::memcmp(_atlas.pixels.data() + (size_t)(rect.y + y) * _atlas.width + rect.x,
+                                _bitmap.pixels.data() + (size_t)y * _bitmap.width, rect.width) == 0;
+        }
+        if (equal)
+            return owner;
+    }
+    return kAtlasNoEntry;
+}
+
+static void LinkSharedCoverage(GlyphAtlas& _atlas, uint32_t _owner)
+{
+    uint32_t& bucket = _atlas.shareBuckets[_atlas.shares[_owner].hash & (uint32_t)(_atlas.shareBuckets.size() - 1u)];
+    _atlas.shares[_owner].nextOwner = bucket;
+    bucket = _owner;
+}
+
+static void UnlinkSharedCoverage(GlyphAtlas& _atlas, uint32_t _owner)
+{
+    uint32_t* link = &_atlas.shareBuckets[_atlas.shares[_owner].hash & (uint32_t)(_atlas.shareBuckets.size() - 1u)];
+    while (*link != _owner)
+        link = &_atlas.shares[*link].nextOwner;
+    *link = _atlas.shares[_owner].nextOwner;
+}
+
+// Entries sharing pixels give up their index right away, the slot is freed with its last user.
+static void ReleaseAtlasEntry(GlyphAtlas& _atlas, uint32_t _entryIndex)
+{
+    AtlasEntry& entry = _atlas.entries[_entryIndex];
+    _atlas.glyphEntries[entry.glyphIndex] = kAtlasNoEntry;
+    entry.glyphIndex = kAtlasNoEntry;
+
+    uint32_t const owner = _atlas.shares[_entryIndex].owner;
+    if (owner != _entryIndex)
+    {
+        entry.slot = entry.rect = AtlasRect{ 0u, 0u, 0u, 0u };
+        _atlas.shares[_entryIndex] = AtlasShare{ _entryIndex, 0u, 0u, kAtlasNoEntry };
+        _atlas.freeEntries.push_back(_entryIndex);
+    }
+
+    if (--_atlas.shares[owner].users == 0u)
+    {
+        if (_atlas.entries[owner].rect.width != 0u)
+            UnlinkSharedCoverage(_atlas, owner);
+        _atlas.freeEntries.push_back(owner);
+    }
+}
+
+Result AcquireGlyph(GlyphAtlas* _atlas, uint32_t _glyphIndex, AtlasEntry* _entry)
+{
+    GlyphAtlas& atlas = *_atlas;
+    if (_glyphIndex >= atlas.glyphEntries.size())
+        return Result::GlyphMissing;
+
+    uint32_t entryIndex = atlas.glyphEntries[_glyphIndex];
+    if (entryIndex != kAtlasNoEntry)
+    {
+        atlas.entries[entryIndex].lastUse = atlas.frame;
+        *_entry = atlas.entries[entryIndex];
+        return Result::Success;
+    }
+
+    Result const result = ReadGlyphIndexData(*atlas.ttfFile, _glyphIndex, &atlas.glyph);
+    if (result != Result::Success)
+        return result;
+    RasterizeGlyph(&atlas.glyph, atlas.pixelSize, atlas.samplingRate, atlas.subPixelEval, &atlas.bitmap);
+
+    CoverageBitmap const& bitmap = atlas.bitmap;
+    uint32_t const hash = HashBytes(bitmap.pixels.data(), bitmap.pixels.size());
+    uint32_t const owner = bitmap.pixels.empty() ? kAtlasNoEntry : FindSharedCoverage(atlas, bitmap, hash);
+    if (owner != kAtlasNoEntry)
+    {
+        entryIndex = ReuseSlotlessEntry(atlas);
+        if (entryIndex == kAtlasNoEntry)
+        {
+            entryIndex = (uint32_t)atlas.entries.size();
+            atlas.entries.emplace_back();
+            atlas.shares.emplace_back();
+        }
+
+        AtlasEntry entry = atlas.entries[owner];
+        entry.glyphIndex = _glyphIndex;
+        entry.left = bitmap.left;
+        entry.top = bitmap.top;
+        entry.lastUse = atlas.frame;
+        atlas.entries[entryIndex] = entry;
+        atlas.shares[entryIndex] = AtlasShare{ owner, 0u, hash, kAtlasNoEntry };
+        ++atlas.shares[owner].users;
+        atlas.glyphEntries[_glyphIndex] = entryIndex;
+        *_entry = entry;
+        return Result::Success;
+    }
+
+    AtlasRect slot{ 0u, 0u, 0u, 0u };
+    if (!bitmap.pixels.empty())
+    {
+        uint32_t const slotWidth = bitmap.width + 1u;
+        uint32_t const slotHeight = bitmap.height + 1u;
+        entryIndex = ReuseFreeSlot(atlas, slotWidth, slotHeight);
+        if (entryIndex != kAtlasNoEntry)
+        {
+            slot = atlas.entries[entryIndex].slot;
+            ClearAtlasRect(atlas, slot);
+            atlas.dirtyRects.push_back(slot);
+        }
+        else if (!AllocateShelfSlot(atlas, slotWidth, slotHeight, &slot))
+        {
+            EvictGlyphs(_atlas, 1u);
+            CompactGlyphAtlas(_atlas);
+            if (!AllocateShelfSlot(atlas, slotWidth, slotHeight, &slot))
+                return Result::AtlasFull;
+        }
+    }
+
+    if (entryIndex == kAtlasNoEntry && bitmap.pixels.empty())
+        entryIndex = ReuseSlotlessEntry(atlas);
+    if (entryIndex == kAtlasNoEntry)
+    {
+        entryIndex = (uint32_t)atlas.entries.size();
+        atlas.entries.emplace_back();
+        atlas.shares.emplace_back();
+    }
+
+    AtlasEntry& entry = atlas.entries[entryIndex];
+    entry.glyphIndex = _glyphIndex;
+    entry.slot = slot;
+    entry.rect = AtlasRect{ slot.x, slot.y, bitmap.width, bitmap.height };
+    entry.left = bitmap.left;
+    entry.top = bitmap.top;
+    entry.lastUse = atlas.frame;
+    atlas.glyphEntries[_glyphIndex] = entryIndex;
+
+    atlas.shares[entryIndex] = AtlasShare{ entryIndex, 1u, hash, kAtlasNoEntry };
+    if (!bitmap.pixels.empty())
+    {
+        CopyAtlasRect(atlas, entry.rect, bitmap.pixels.data(), bitmap.width);
+        atlas.dirtyRects.push_back(entry.rect);
+        LinkSharedCoverage(atlas, entryIndex);
+    }
+
+    *_entry = entry;
+    return Result::Success;
+}
+
+size_t EvictGlyphs(GlyphAtlas* _atlas, uint64_t _maxAge)
+{
+    GlyphAtlas& atlas = *_atlas;
+    size_t evicted = 0u;
+    for (uint32_t entryIndex = 0u; entryIndex < atlas.entries.size(); ++entryIndex)
+    {
+        AtlasEntry const& entry = atlas.entries[entryIndex];
+        if (entry.glyphIndex == kAtlasNoEntry || entry.lastUse + _maxAge > atlas.frame)
+            continue;
+
+        ReleaseAtlasEntry(atlas, entryIndex);
+        ++evicted;
+    }
+    return evicted;
+}
+
+void CompactGlyphAtlas(GlyphAtlas* _atlas)
+{
+    GlyphAtlas& atlas = *_atlas;
+
+    // Owners in use are repacked with their pixels, the entries sharing them follow.
+    std::vector<uint32_t> owners{};
+    for (uint32_t entryIndex = 0u; entryIndex < atlas.entries.size(); ++entryIndex)
+    {
+        if (atlas.shares[entryIndex].owner == entryIndex && atlas.shares[entryIndex].users != 0u)
+            owners.push_back(entryIndex);
+    }
+    std::stable_sort(owners.begin(), owners.end(), [&atlas](uint32_t _a, uint32_t _b)
+    {
+        return atlas.entries[_a].slot.height > atlas.entries[_b].slot.height;
+    });
+
+    std::vector<AtlasEntry> const entries = std::move(atlas.entries);
+    std::vector<AtlasShare> const shares = std::move(atlas.shares);
+    std::vector<uint8_t> const previous = std::move(atlas.pixels);
+    atlas.pixels.assign((size_t)atlas.width * atlas.height, 0u);
+    atlas.shelves.clear();
+    atlas.freeEntries.clear();
+    atlas.entries.clear();
+    atlas.shares.clear();
+    std::fill(atlas.shareBuckets.begin(), atlas.shareBuckets.end(), kAtlasNoEntry);
+
+    // Glyphs that do not fit after repacking are dropped and rasterized again on their next use.
+    std::vector<uint32_t> movedOwners(entries.size(), kAtlasNoEntry);
+    for (uint32_t owner : owners)
+    {
+        AtlasEntry entry = entries[owner];
+        AtlasRect slot{ 0u, 0u, 0u, 0u };
+        if (entry.slot.width != 0u && !AllocateShelfSlot(atlas, entry.slot.width, entry.slot.height, &slot))
+            continue;
+
+        AtlasRect const rect{ slot.x, slot.y, entry.rect.width, entry.rect.height };
+        CopyAtlasRect(atlas, rect, previous.data() + (size_t)entry.rect.y * atlas.width + entry.rect.x, atlas.width);
+        entry.slot = slot;
+        entry.rect = rect;
+        movedOwners[owner] = (uint32_t)atlas.entries.size();
+        atlas.entries.push_back(entry);
+        atlas.shares.push_back(AtlasShare{ movedOwners[owner], 0u, shares[owner].hash, kAtlasNoEntry });
+        if (rect.width != 0u)
+            LinkSharedCoverage(atlas, movedOwners[owner]);
+    }
+
+    for (uint32_t entryIndex = 0u; entryIndex < entries.size(); ++entryIndex)
+    {
+        AtlasEntry entry = entries[entryIndex];
+        if (entry.glyphIndex == kAtlasNoEntry)
+            continue;
+
+        uint32_t const owner = movedOwners[shares[entryIndex].owner];
+        uint32_t movedEntry = owner;
+        if (owner == kAtlasNoEntry)
+        {
+            atlas.glyphEntries[entry.glyphIndex] = kAtlasNoEntry;
+            continue;
+        }
+        if (shares[entryIndex].owner != entryIndex)
+        {
+            entry.slot = atlas.entries[owner].slot;
+            entry.rect = atlas.entries[owner].rect;
+            movedEntry = (uint32_t)atlas.entries.size();
+            atlas.entries.push_back(entry);
+            atlas.shares.push_back(AtlasShare{ owner, 0u, shares[entryIndex].hash, kAtlasNoEntry });
+        }
+        ++atlas.shares[owner].users;
+        atlas.glyphEntries[entry.glyphIndex] = movedEntry;
+    }
+
+    ++atlas.generation;
+    atlas.dirtyRects.clear();
+    atlas.dirtyRects.push_back(AtlasRect{ 0u, 0u, atlas.width, atlas.height });
+}
+
+// A render shared by all tickets submitted for the same request while it is in flight.
+struct RenderJob
+{
+    RenderRequest request;
+    uint32_t priority;
+    bool started, done;
+    Result result;
+    std::vector<uint64_t> tickets{};
+    CoverageBitmap bitmap{};
+};
+
+struct RenderTicket
+{
+    std::shared_ptr<RenderJob> job;
+    RenderCallback callback;
+    void* user;
+};
+
+// Queued items are not removed when their job is cancelled or pushed again at a higher priority,
+// workers skip them instead.
+struct RenderQueueItem
+{
+    uint32_t priority;
+    uint64_t sequence;
+    std::shared_ptr<RenderJob> job;
+};
+
+struct RenderRequestHash
+{
+    size_t operator()(RenderRequest const& _request) const
+    {
+        uint32_t pixelSize;
+        std::memcpy(&pixelSize, &_request.pixelSize, sizeof(pixelSize));
+        size_t hash = (size_t)(uintptr_t)_request.ttfFile;
+        hash = hash * 0x9E3779B1u + _request.glyphIndex;
+        hash = hash * 0x9E3779B1u + pixelSize;
+        return hash * 0x9E3779B1u + (_request.samplingRate << 1u | (uint32_t)_request.subPixelEval);
+    }
+};
+
+struct RenderRequestEqual
+{
+    bool operator()(RenderRequest const& _lhs, RenderRequest const& _rhs) const
+    {
+        return _lhs.ttfFile == _rhs.ttfFile && _lhs.glyphIndex == _rhs.glyphIndex
+               && _lhs.pixelSize == _rhs.pixelSize && _lhs.samplingRate == _rhs.samplingRate
+               && _lhs.subPixelEval == _rhs.subPixelEval;
+    }
+};
+
+struct RenderService
+{
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::condition_variable finished;
+    std::vector<RenderQueueItem> queue{}; // max heap on (priority, -sequence)
+    std::unordered_map<RenderRequest, std::shared_ptr<RenderJob>, RenderRequestHash, RenderRequestEqual> inFlight{};
+    std::unordered_map<uint64_t, RenderTicket> tickets{};
+    uint64_t nextTicket = 1u;
+    uint64_t nextSequence = 0u;
+    bool stopping = false;
+    std::vector<std::thread> workers{};
+};
+
+static bool RenderQueueLess(RenderQueueItem const& _lhs, RenderQueueItem const& _rhs)
+{
+    if (_lhs.priority != _rhs.priority)
+        return _lhs.priority < _rhs.priority;
+    return _lhs.sequence > _rhs.sequence;
+}
+
+static void PushRenderJob(RenderService& _service, std::shared_ptr<RenderJob> const& _job)
+{
+    _service.queue.push_back(RenderQueueItem{ _job->priority, _service.nextSequence++, _job });
+    std::push_heap(_service.queue.begin(), _service.queue.end(), RenderQueueLess);
+}
+
+static void RunRenderWorker(RenderService& _service)
+{
+    Glyph glyph{};
+    std::vector<std::pair<uint64_t, RenderTicket>> callbacks{};
+    std::unique_lock<std::mutex> lock(_service.mutex);
+    for (;;)
+    {
+        _service.queued.wait(lock, [&]() { return _service.stopping || !_service.queue.empty(); });
+        if (_service.stopping)
+            return;
+
+        std::pop_heap(_service.queue.begin(), _service.queue.end(), RenderQueueLess);
+        std::shared_ptr<RenderJob> job = std::move(_service.queue.back().job);
+        uint32_t const priority = _service.queue.back().priority;
+        _service.queue.pop_back();
+        if (job->started || job->tickets.empty() || job->priority != priority)
+            continue;
+
+        // Coalesced submits keep attaching tickets while the glyph renders, the request itself
+        // does not change any more.
+        job->started = true;
+        lock.unlock();
+        RenderRequest const& request = job->request;
+        job->result = ReadGlyphIndexData(*request.ttfFile, request.glyphIndex, &glyph);
+        if (job->result == Result::Success)
+            RasterizeGlyph(&glyph, request.pixelSize, request.samplingRate, request.subPixelEval, &job->bitmap);
+        lock.lock();
+
+        job->done = true;
+        _service.inFlight.erase(request);
+        for (uint64_t ticket : job->tickets)
+        {
+            auto found = _service.tickets.find(ticket);
+            if (found == _service.tickets.end() || found->second.callback == nullptr)
+                continue;
+            callbacks.emplace_back(ticket, std::move(found->second));
+            _service.tickets.erase(found);
+        }
+        _service.finished.notify_all();
+        if (callbacks.empty())
+            continue;
+
+        lock.unlock();
+        for (std::pair<uint64_t, RenderTicket> const& callback : callbacks)
+            callback.second.callback(callback.second.user, callback.first, job->result, job->bitmap);
+        callbacks.clear();
+        lock.lock();
+    }
+}
+
+RenderService* CreateRenderService(uint32_t _threadCount)
+{
+    RenderService* service = new RenderService();
+    for (uint32_t index = 0u; index < std::max(1u, _threadCount); ++index)
+        service->workers.emplace_back([service]() { RunRenderWorker(*service); });
+    return service;
+}
+
+void DestroyRenderService(RenderService* _service)
+{
+    {
+        std::lock_guard<std::mutex> lock(_service->mutex);
+        _service->stopping = true;
+    }
+    _service->queued.notify_all();
+    for (std::thread& worker : _service->workers)
+        worker.join();
+    delete _service;
+}
+
+uint64_t SubmitRender(RenderService* _service, RenderRequest const& _request, uint32_t _priority,
+                      RenderCallback _callback, void* _user)
+{
+    RenderService& service = *_service;
+    bool pushed = false;
+    uint64_t ticket;
+    {
+        std::lock_guard<std::mutex> lock(service.mutex);
+        ticket = service.nextTicket++;
+        std::shared_ptr<RenderJob>& job = service.inFlight[_request];
+        if (job == nullptr)
+        {
+            job = std::make_shared<RenderJob>();
+            job->request = _request;
+            job->priority = _priority;
+            PushRenderJob(service, job);
+            pushed = true;
+        }
+        else if (!job->started && _priority > job->priority)
+        {
+            job->priority = _priority;
+            PushRenderJob(service, job);
+            pushed = true;
+        }
+        job->tickets.push_back(ticket);
+        service.tickets.emplace(ticket, RenderTicket{ job, _callback, _user });
+    }
+    if (pushed)
+        service.queued.notify_one();
+    return ticket;
+}
+
+bool CancelRender(RenderService* _service, uint64_t _ticket)
+{
+    RenderService& service = *_service;
+    std::lock_guard<std::mutex> lock(service.mutex);
+    auto found = service.tickets.find(_ticket);
+    if (found == service.tickets.end())
+        return false;
+
+    std::shared_ptr<RenderJob> job = std::move(found->second.job);
+    service.tickets.erase(found);
+    service.finished.notify_all();
+    if (job->done)
+        return false;
+
+    job->tickets.erase(std::find(job->tickets.begin(), job->tickets.end(), _ticket));
+    if (job->tickets.empty() && !job->started)
+        service.inFlight.erase(job->request);
+    return true;
+}
+
+Result WaitRender(RenderService* _service, uint64_t _ticket, CoverageBitmap* _bitmap, bool _block)
+{
+    RenderService& service = *_service;
+    std::shared_ptr<RenderJob> job;
+    {
+        std::unique_lock<std::mutex> lock(service.mutex);
+        auto found = service.tickets.find(_ticket);
+        if (found == service.tickets.end() || found->second.callback != nullptr)
+            return Result::Cancelled;
+
+        job = found->second.job;
+        if (!job->done)
+        {
+            if (!_block)
+                return Result::Incomplete;
+            service.finished.wait(lock, [&]() { return job->done || service.tickets.count(_ticket) == 0u; });
+            found = service.tickets.find(_ticket);
+            if (found == service.tickets.end())
+                return Result::Cancelled;
+        }
+        service.tickets.erase(found);
+    }
+    // Finished jobs are no longer written to.
+    *_bitmap = job->bitmap;
+    return job->result;
+}
+
+void const* ExtractOffsetSubtable(void const* _ptr, OffsetSubtable& _output)
+{
+    void const* nextPtr = AdvancePointer<OffsetSubtable>(_ptr);
+    _output.scalerType = ReadU32(_ptr);
+    _output.numTables = ReadU16(_ptr);
+    _output.searchRange = ReadU16(_ptr);
+    _output.entrySelector = ReadU16(_ptr);
+    _output.rangeShift = ReadU16(_ptr);
+    return nextPtr;
+}
+
+void const* ExtractTableDirectory(void const* _ptr, uint16_t _count, TableDirectoryEntry* _output)
+{
+    void const* nextPtr = AdvancePointer<TableDirectoryEntry>(_ptr, (size_t)_count);
+    for (uint16_t index = 0u; index < _count; ++index)
+    {
+        void const* ptr = AdvancePointer<TableDirectoryEntry>(_ptr);
+        _output[index].tag = ReadU32(_ptr);
+        _output[index].checkSum = ReadU32(_ptr);
+        _output[index].offset = ReadU32(_ptr);
+        _output[index].length = ReadU32(_ptr);
+        _ptr = ptr;
+    }
+    return nextPtr;
+}
+
+uint32_t ExtractGlyphIndex(void const* _ptr, uint16_t _format, uint32_t _charCode)
+{
+    uint32_t glyphIndex = 0u;
+
+    if (_format == 4)
+    {
+        uint16_t length = ReadU16(_ptr);
+        uint16_t language = ReadU16(_ptr);
+        uint16_t segCount = ReadU16(_ptr) / 2;
+        uint16_t searchRange = ReadU16(_ptr);
+        uint16_t entrySelector = ReadU16(_ptr);
+        uint16_t rangeShift = ReadU16(_ptr);
+        std::vector<uint16_t> endCode(segCount);
+        _ptr = ReadU16(_ptr, endCode.data(), endCode.size());
+        uint16_t reservedPad = ReadU16(_ptr);
+        std::vector<uint16_t> startCode(segCount);
+        _ptr = ReadU16(_ptr, startCode.data(), startCode.size());
+        std::vector<uint16_t> idDelta(segCount);
+        _ptr = ReadU16(_ptr, idDelta.data(), idDelta.size());
+        std::vector<uint16_t> idRangeOffset(segCount);
+        _ptr = ReadU16(_ptr, idRangeOffset.data(), idRangeOffset.size());
+        uint16_t const* glyphIndexArrayBase = (uint16_t const*)_ptr;
+
+        //std::cout << std::dec << "seg count " << segCount << std::endl;
+        for (uint16_t index = 0u; index < segCount; ++index)
+        {
+            if ((uint32_t)endCode[index] >= _charCode)
+            {
+                if ((uint32_t)startCode[index] > _charCode)
+                {
+                    //std::cout << "missing glyph" << std::endl;
+                    break;
+                }
+
+                /*
+                std::cout << "glyph page location " << index << std::endl;
+                std::cout << std::hex
+                          << "page begin " << startCode[index] << std::endl
+                          << "page end " << endCode[index] << std::endl
+                          << "idRangeOffset " << idRangeOffset[index] << std::endl
+                          << "idDelta " << idDelta[index] << std::endl;
+                */
+
+                if (!idRangeOffset[index])
+                    glyphIndex = (uint32_t)(idDelta[index] + _charCode) & 0xffff;
+                else
+                {
+                    uint32_t offset = idRangeOffset[index]/2 + (_charCode - startCode[index]);
+                    void const* pIndex = glyphIndexArrayBase + offset + index - segCount;
+                    glyphIndex = (uint32_t)ReadU16(pIndex);
+                }
+
+                break;
+            }
+        }
+        //std::cout << std::dec << "glyph index " << glyphIndex << std::endl;
+    }
+
+    if (_format == 12)
+    {
+        ReadU16(_ptr); // reserved u16
+        uint32_t length = ReadU32(_ptr);
+        uint32_t language = ReadU32(_ptr);
+        uint32_t nGroups = ReadU32(_ptr);
+
+        //std::cout << std::hex << "looking for " << _charCode << std::endl;
+        for (uint32_t index = 0u; index < nGroups; ++index)
+        {
+            uint32_t startCharCode = ReadU32(_ptr);
+            uint32_t endCharCode = ReadU32(_ptr);
+            uint32_t startGlyphCode = ReadU32(_ptr);
+
+            /*
+            std::cout << std::hex
+                      << "start code " << startCharCode << std::endl
+                      << "end code " << endCharCode << std::endl
+                      << "start glyph " << startGlyphCode << std::endl;
+            */
+
+            if (_charCode >= startCharCode && _charCode <= endCharCode)
+            {
+                glyphIndex = startGlyphCode + (_charCode - startCharCode);
+                break;
+            }
+        }
+        //std::cout << std::dec << "glyph index " << glyphIndex << std::endl;
+    }
+
+    return glyphIndex;
+}
+
+// Decodes one axis of simple glyph coordinates, _shortBit and _sameBit are the flag bits of the axis
+// (2 and 16 for x, 4 and 32 for y). Returns the first byte past the axis data.
+static uint8_t const* DecodeGlyphCoordinates(uint8_t const* _flags, uint16_t _pointCount,
+                                             uint8_t _shortBit, uint8_t _sameBit,
+                                             uint8_t const* _data, uint8_t const* _dataEnd,
+                                             int16_t* _coordinates)
+{
+    uint16_t pointIndex = 0u;
+    int16_t coordinate = 0;
+
+#ifdef TTFTK_SSSE3
+    // Eight points per step: byte widths from the flags, offsets by prefix sum, one shuffle gathers the
+    // big endian words and short bytes, then signs are applied and the deltas are prefix summed.
+    // A step reads at most 16 bytes, the scalar loop finishes near the end of the glyph data.
+    __m128i const shortBit = _mm_set1_epi16(_shortBit);
+    __m128i const sameBit = _mm_set1_epi16(_sameBit);
+    __m128i const one = _mm_set1_epi16(1);
+    __m128i const two = _mm_set1_epi16(2);
+    __m128i const zeroIndex = _mm_set1_epi16(0x80);
+    while (pointIndex + 8u <= _pointCount && _data + 16 <= _dataEnd)
+    {
+        __m128i const flags = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const*)(_flags + pointIndex)),
+                                                _mm_setzero_si128());
+        __m128i const isShort = _mm_cmpeq_epi16(_mm_and_si128(flags, shortBit), shortBit);
+        __m128i const isSame = _mm_cmpeq_epi16(_mm_and_si128(flags, sameBit), sameBit);
+        __m128i const isWord = _mm_andnot_si128(_mm_or_si128(isShort, isSame), _mm_set1_epi16(-1));
+        __m128i const isZero = _mm_andnot_si128(isShort, isSame);
+
+        __m128i const width = _mm_or_si128(_mm_and_si128(isShort, one), _mm_and_si128(isWord, two));
+        __m128i end = _mm_add_epi16(width, _mm_slli_si128(width, 2));
+        end = _mm_add_epi16(end, _mm_slli_si128(end, 4));
+        end = _mm_add_epi16(end, _mm_slli_si128(end, 8));
+        __m128i const offset = _mm_sub_epi16(end, width);
+
+        // Low byte of each lane takes the short byte or the low byte of the word, high byte the high byte
+        // of the word. 0x80 shuffles in zero.
+        __m128i lowIndex = _mm_add_epi16(offset, _mm_and_si128(isWord, one));
+        lowIndex = _mm_or_si128(lowIndex, _mm_and_si128(isZero, zeroIndex));
+        __m128i const highIndex = _mm_or_si128(_mm_and_si128(isWord, offset), _mm_andnot_si128(isWord, zeroIndex));
+        __m128i const shuffle = _mm_or_si128(lowIndex, _mm_slli_epi16(highIndex, 8));
+
+        __m128i delta = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const*)_data), shuffle);
+        __m128i const negate = _mm_andnot_si128(isSame, isShort);
+        delta = _mm_sub_epi16(_mm_xor_si128(delta, negate), negate);
+
+        delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 2));
+        delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 4));
+        delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 8));
+        delta = _mm_add_epi16(delta, _mm_set1_epi16(coordinate));
+        _mm_storeu_si128((__m128i*)(_coordinates + pointIndex), delta);
+
+        coordinate = (int16_t)_mm_extract_epi16(delta, 7);
+        _data += _mm_extract_epi16(end, 7);
+        pointIndex += 8u;
+    }
+#else
+    (void)_dataEnd;
+#endif
+
+    void const* ptr = (void const*)_data;
+    for (; pointIndex < _pointCount; ++pointIndex)
+    {
+        int16_t delta = 0;
+        if (_flags[pointIndex] & _shortBit)
+        {
+            delta = ReadU8(ptr);
+            if (!(_flags[pointIndex] & _sameBit))
+                delta = -delta;
+        }
+        else if (!(_flags[pointIndex] & _sameBit))
+            delta = ReadS16(ptr);
+
+        coordinate += delta;
+        _coordinates[pointIndex] = coordinate;
+    }
+
+    return (uint8_t const*)ptr;
+}
+
+GlyphPoints ExtractGlyphPoints(uint8_t const* _loca,
+                               uint8_t const* _glyf,
+                               uint16_t _indexToLocFormat,
+                               uint32_t _glyphIndex)
+{
+    GlyphPoints output{};
+
+    uint32_t glyphOffset = 0u;
+    uint32_t nextGlyphOffset = 0u;
+    if (_indexToLocFormat == 0)
+    {
+        void const* ptr = _loca + _glyphIndex * 2;
+        glyphOffset = ReadU16(ptr) * 2;
+        nextGlyphOffset = ReadU16(ptr) * 2;
+    }
+    else
+    {
+        void const* ptr = _loca + _glyphIndex * 4;
+        glyphOffset = ReadU32(ptr);
+        nextGlyphOffset = ReadU32(ptr);
+    }
+
+    // Glyphs without outline (e.g. space) have no data in glyf.
+    if (nextGlyphOffset == glyphOffset)
+        return output;
+
+    void const* ptr = _glyf + glyphOffset;
+    int16_t numberOfContours = ReadS16(ptr);
+    output.xmin = ReadS16(ptr);
+    output.ymin = ReadS16(ptr);
+    output.xmax = ReadS16(ptr);
+    output.ymax = ReadS16(ptr);
+
+    if (numberOfContours > 0)
+    {
+        output.endPoints.resize(numberOfContours);
+        ptr = ReadU16(ptr, output.endPoints.data(), output.endPoints.size());
+        uint16_t instructionLength = ReadU16(ptr);
+        uint8_t const* instructions = (uint8_t const*)ptr;
+        ptr = AdvancePointer<uint8_t>(ptr, instructionLength);
+        uint8_t const* flagsArray = (uint8_t const*)ptr;
+
+        output.pointCount = output.endPoints[output.endPoints.size()-1] + 1;
+        output.contourFlags.resize(output.pointCount);
+        output.contourX.resize(output.pointCount);
+        output.contourY.resize(output.pointCount);
+
+        // Repeats are clamped so that a malformed flag run cannot write past the point count.
+        uint16_t pointIndex = 0u;
+        while (pointIndex < output.pointCount)
+        {
+            uint8_t flags = *flagsArray++;
+            if (flags & 8)
+            {
+                uint16_t repeatCount = std::min<uint16_t>(1 + *flagsArray++, output.pointCount - pointIndex);
+                std::memset(&output.contourFlags[pointIndex], flags, repeatCount);
+                pointIndex += repeatCount;
+            }
+            else
+                output.contourFlags[pointIndex++] = flags;
+        }
+
+        uint8_t const* const glyphEnd = _glyf + nextGlyphOffset;
+        uint8_t const* yArray = DecodeGlyphCoordinates(output.contourFlags.data(), output.pointCount, 2, 16,
+                                                       flagsArray, glyphEnd, output.contourX.data());
+        DecodeGlyphCoordinates(output.contourFlags.data(), output.pointCount, 4, 32,
+                               yArray, glyphEnd, output.contourY.data());
+    }
+
+    else if (numberOfContours < 0)
+    {
+        output.pointCount = 0u;
+
+        //std::cout << "composite glyph" << std::endl;
+        uint16_t flags = 32;
+        while (flags & 32)
+        {
+            float a = 1.f, b = 0.f, c = 0.f, d = 1.f, e = 0.f, f = 0.f;
+
+            flags = ReadU16(ptr);
+            uint16_t componentIndex = ReadU16(ptr);
+            switch (flags & 3)
+            {
+            case 0:
+            case 1:
+            {
+                //std::cout << "matching points unsupported" << std::endl;
+                return{};
+            } break;
+            case 2:
+            {
+                e = (float)ReadS8(ptr);
+                f = (float)ReadS8(ptr);
+            } break;
+            case 3:
+            {
+                e = (float)ReadS16(ptr);
+                f = (float)ReadS16(ptr);
+            } break;
+            }
+
+            if (flags & 8)
+            {
+                a = d = F2Dot14(ReadS16(ptr));
+                b = c = 0.f;
+            }
+            if (flags & 64)
+            {
+                a = F2Dot14(ReadS16(ptr));
+                d = F2Dot14(ReadS16(ptr));
+                b = c = 0.f;
+            }
+            if (flags & 128)
+            {
+                a = F2Dot14(ReadS16(ptr));
+                b = F2Dot14(ReadS16(ptr));
+                c = F2Dot14(ReadS16(ptr));
+                d = F2Dot14(ReadS16(ptr));
+            }
+
+            // These are not the formulas documented on Apple's website,
+            // other sources claim that they are the correct ones.
+            // http://pfaedit.sourceforge.net/Composites/index.html
+            float m = std::sqrt(a*a + b*b);
+            float n = std::sqrt(c*c + d*d);
+
+            bool windingFlip = (a*d - b*c < 0.f);
+
+            TTFTK_COUNT(compositeRecursions, 1);
+            GlyphPoints points = ExtractGlyphPoints(_loca, _glyf, _indexToLocFormat, componentIndex);
+            uint16_t beginRange = output.pointCount;
+            output.pointCount += points.pointCount;
+            output.contourFlags.resize(output.pointCount);
+            output.contourX.resize(output.pointCount);
+            output.contourY.resize(output.pointCount);
+            output.endPoints.reserve(output.endPoints.size() + points.endPoints.size());
+            for (uint16_t endPoint : points.endPoints)
+                output.endPoints.push_back(beginRange + endPoint);
+
+            if (!windingFlip)
+            {
+                for (uint16_t pointIndex = 0u; pointIndex < points.pointCount; ++pointIndex)
+                {
+                    output.contourFlags[beginRange + pointIndex] = points.contourFlags[pointIndex];
+
+                    int16_t x = points.contourX[pointIndex];
+                    int16_t y = points.contourY[pointIndex];
+                    output.contourX[beginRange + pointIndex] = (int16_t)(m * (a*x + c*y + e));
+                    output.contourY[beginRange + pointIndex] = (int16_t)(n * (b*x + d*y + f));
+                }
+            }
+
+            else
+            {
+                for (uint16_t pointIndex = 0u; pointIndex < points.pointCount; ++pointIndex)
+                {
+                    output.contourFlags[beginRange + pointIndex] =
+                        points.contourFlags[points.pointCount-1 - pointIndex];
+
+                    int16_t x = points.contourX[points.pointCount-1 - pointIndex];
+                    int16_t y = points.contourY[points.pointCount-1 - pointIndex];
+                    output.contourX[beginRange + pointIndex] = (int16_t)(m * (a*x + c*y + e));
+                    output.contourY[beginRange + pointIndex] = (int16_t)(n * (b*x + d*y + f));
+                }
+            }
+        }
+    }
+
+    return output;
+}
+
+uint16_t IntersectSpline(float const _pointTraceAxis[3], float const _pointCrossAxis[3],
+                         float* _x0, float* _x1)
+{
+    TTFTK_COUNT(splineIntersections, 1);
+
+    static constexpr uint16_t kLUT = 0x2E74u;
+
+    uint8_t const key = (((_pointCrossAxis[0] > 0.f) ? 2 : 0)
+                         | ((_pointCrossAxis[1] > 0.f) ? 4 : 0)
+                         | ((_pointCrossAxis[2] > 0.f) ? 8 : 0));
+
+    uint16_t const intType = kLUT >> key;
+    if (intType & 3)
+    {
+        float const a0 = _pointCrossAxis[0] - 2.f*_pointCrossAxis[1] + _pointCrossAxis[2];
+        float const b0 = _pointCrossAxis[0] - _pointCrossAxis[1];
+        float const c0 = _pointCrossAxis[0];
+
+        float const a1 = _pointTraceAxis[0] - 2.f*_pointTraceAxis[1] + _pointTraceAxis[2];
+        float const b1 = _pointTraceAxis[0] - _pointTraceAxis[1];
+        float const c1 = _pointTraceAxis[0];
+
+        if (a0 == 0.f)
+        {
+            float const t = c0 / (2.f * b0);
+            float const cx = a1*t*t - b1*2.f*t + c1;
+
+            if (intType & 1)
+                *_x0 = cx;
+            if (intType & 2)
+                *_x1 = cx;
+        }
+        else
+        {
+            // Roots (b0 -/+ h) / a0 of a0.t^2 - 2.b0.t + c0, computed as q / a0 and c0 / q
+            // to avoid the cancellation that nearly linear segments otherwise need an epsilon for.
+            float const h = std::sqrt(std::max(b0*b0 - a0*c0, 0.f));
+            float const q = (b0 >= 0.f) ? b0 + h : b0 - h;
+            float const nearRoot = (q != 0.f) ? c0 / q : 0.f;
+            float const farRoot = q / a0;
+
+            if (intType & 1)
+            {
+                float const t0 = (b0 >= 0.f) ? nearRoot : farRoot;
+                *_x0 = a1*t0*t0 - b1*2.f*t0 + c1;
+            }
+
+            if (intType & 2)
+            {
+                float const t1 = (b0 >= 0.f) ? farRoot : nearRoot;
+                *_x1 = a1*t1*t1 - b1*2.f*t1 + c1;
+            }
+        }
+    }
+
+    return intType;
+}
+
+#if defined(__SIZEOF_INT128__)
+// Sign of _a + _b.sqrt(_d), _d >= 0. Operands stay below 2^55, squares below 2^110.
+static inline int32_t SignOfRootSum(int64_t _a, int64_t _b, int64_t _d)
+{
+    int32_t const signA = (_a > 0) - (_a < 0);
+    int32_t const signB = (_d == 0) ? 0 : (_b > 0) - (_b < 0);
+    if (signB == 0 || signA == signB)
+        return signA;
+    if (signA == 0)
+        return signB;
+
+    __int128 const squareA = (__int128)_a * _a;
+    __int128 const squareB = (__int128)_b * _b * _d;
+    if (squareA == squareB)
+        return 0;
+    return (squareA > squareB) ? signA : signB;
+}
+#endif
+
+// Same crossings as IntersectSpline, masked to those at trace >= 0, for coordinates relative to the
+// sample that fit 17 bits. Segments entirely on one side of the sample need no roots at all, the
+// others compare the root positions exactly: with y(t) = a.t^2 - 2b.t + c, D = b^2 - ac and
+// t = (b -/+ sqrt(D)) / a, a^2.x(t) = A -/+ P.sqrt(D) whose sign is decided on squares.
+uint16_t CrossSplineExact(int32_t const _pointTraceAxis[3], int32_t const _pointCrossAxis[3])
+{
+    TTFTK_COUNT(splineIntersections, 1);
+
+    static constexpr uint16_t kLUT = 0x2E74u;
+
+    uint8_t const key = (((_pointCrossAxis[0] > 0) ? 2 : 0)
+                         | ((_pointCrossAxis[1] > 0) ? 4 : 0)
+                         | ((_pointCrossAxis[2] > 0) ? 8 : 0));
+
+    uint16_t const intType = (kLUT >> key) & 3u;
+    if (intType == 0u)
+        return 0u;
+
+    // Crossings lie in the hull of the control points.
+    int32_t const* const x = _pointTraceAxis;
+    if (x[0] >= 0 && x[1] >= 0 && x[2] >= 0)
+        return intType;
+    if (x[0] < 0 && x[1] < 0 && x[2] < 0)
+        return 0u;
+
+#if defined(__SIZEOF_INT128__)
+    int64_t const a0 = (int64_t)_pointCrossAxis[0] - 2*(int64_t)_pointCrossAxis[1] + _pointCrossAxis[2];
+    int64_t const b0 = (int64_t)_pointCrossAxis[0] - _pointCrossAxis[1];
+    int64_t const c0 = _pointCrossAxis[0];
+
+    int64_t const a1 = (int64_t)x[0] - 2*(int64_t)x[1] + x[2];
+    int64_t const b1 = (int64_t)x[0] - x[1];
+    int64_t const c1 = x[0];
+
+    if (a0 == 0)
+    {
+        // t = c0 / 2b0, b0 != 0 since the ends are on both sides.
+        int64_t const scaled = a1*c0*c0 - 4*b1*c0*b0 + 4*c1*b0*b0;
+        return (scaled >= 0) ? intType : 0u;
+    }
+
+    // Both crossings coincide or vanish, their contributions cancel out.
+    int64_t const discriminant = b0*b0 - a0*c0;
+    if (discriminant < 0)
+        return 0u;
+
+    int64_t const common = a1*(2*b0*b0 - a0*c0) - 2*a0*b0*b1 + c1*a0*a0;
+    int64_t const rootFactor = 2*(a1*b0 - a0*b1);
+
+    uint16_t crossings = 0u;
+    if ((intType & 1) && SignOfRootSum(common, -rootFactor, discriminant) >= 0)
+        crossings |= 1u;
+    if ((intType & 2) && SignOfRootSum(common, rootFactor, discriminant) >= 0)
+        crossings |= 2u;
+    return crossings;
+#else
+    float const traceAxis[3] { (float)x[0], (float)x[1], (float)x[2] };
+    float const crossAxis[3] { (float)_pointCrossAxis[0], (float)_pointCrossAxis[1], (float)_pointCrossAxis[2] };
+    float x0 = -1.f;
+    float x1 = -1.f;
+    IntersectSpline(traceAxis, crossAxis, &x0, &x1);
+    return (uint16_t)(((intType & 1) && x0 >= 0.f) ? 1u : 0u) | (((intType & 2) && x1 >= 0.f) ? 2u : 0u);
+#endif
+}
+
+static uint32_t HashBytes(uint8_t const* _bytes, size_t _size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t index = 0u; index < _size; ++index)
+        hash = (hash ^ _bytes[index]) * 16777619u;
+    return hash;
+}
+
+static void ReadSourceStamp(TrueTypeFile const& _ttfFile, uint32_t* _checksum, uint32_t _modified[2])
+{
+    void const* ptr = _ttfFile.memory + _ttfFile.required.head->offset + 8;
+    *_checksum = ReadU32(ptr);
+    ptr = AdvancePointer<uint8_t>(ptr, 16);
+    _modified[0] = ReadU32(ptr);
+    _modified[1] = ReadU32(ptr);
+}
+
+static void CompileHeader(TrueTypeFile const& _ttfFile, CompiledFontHeader* _header)
+{
+    CompiledFontHeader& header = *_header;
+    header = CompiledFontHeader{};
+    header.magic = kCompiledFontMagic;
+    header.version = kCompiledFontVersion;
+    ReadSourceStamp(_ttfFile, &header.sourceChecksum, header.sourceModified);
+    header.xmin = _ttfFile.xmin;
+    header.ymin = _ttfFile.ymin;
+    header.xmax = _ttfFile.xmax;
+    header.ymax = _ttfFile.ymax;
+    header.emsize = _ttfFile.emsize;
+    header.ascent = _ttfFile.ascent;
+    header.descent = _ttfFile.descent;
+    header.lineGap = _ttfFile.lineGap;
+    header.advanceWidthMax = _ttfFile.advanceWidthMax;
+    header.glyphCount = _ttfFile.glyphCount;
+}
+
+static void CompileCharRanges(TrueTypeFile const& _ttfFile, std::vector<CompiledCharRange>* _charRanges)
+{
+    std::vector<CompiledCharRange>& charRanges = *_charRanges;
+    charRanges.clear();
+    for (uint32_t charCode : ListCharCodes(_ttfFile))
+    {
+        uint32_t const glyphIndex = GetGlyphIndex(_ttfFile, charCode);
+        if (glyphIndex == 0u)
+            continue;
+
+        int32_t const glyphDelta = (int32_t)(glyphIndex - charCode);
+        if (!charRanges.empty()
+            && charRanges.back().lastCode + 1u == charCode
+            && charRanges.back().glyphDelta == glyphDelta)
+            charRanges.back().lastCode = charCode;
+        else
+            charRanges.push_back(CompiledCharRange{ charCode, charCode, glyphDelta });
+    }
+}
+
+static void CompileMetrics(TrueTypeFile const& _ttfFile, std::vector<CompiledGlyph>* _glyphs)
+{
+    for (uint32_t glyphIndex = 0u; glyphIndex < _glyphs->size(); ++glyphIndex)
+    {
+        GlyphMetrics const metrics = GetGlyphMetrics(_ttfFile, glyphIndex);
+        (*_glyphs)[glyphIndex].advanceWidth = metrics.advanceWidth;
+        (*_glyphs)[glyphIndex].leftSideBearing = metrics.leftSideBearing;
+    }
+}
+
+static void CompileOutlines(TrueTypeFile const& _ttfFile, std::vector<CompiledGlyph>* _glyphs,
+                            std::vector<uint32_t>* _contourEnds,
+                            std::vector<int16_t>* _pointX, std::vector<int16_t>* _pointY)
+{
+    std::vector<CompiledGlyph>& glyphs = *_glyphs;
+    std::vector<uint32_t>& contourEnds = *_contourEnds;
+    std::vector<int16_t>& pointX = *_pointX;
+    std::vector<int16_t>& pointY = *_pointY;
+    glyphs.assign(_ttfFile.glyphCount, CompiledGlyph{});
+    contourEnds.clear();
+    pointX.clear();
+    pointY.clear();
+
+    Glyph glyph{};
+    for (uint32_t glyphIndex = 0u; glyphIndex < _ttfFile.glyphCount; ++glyphIndex)
+    {
+        CompiledGlyph& compiled = glyphs[glyphIndex];
+        compiled.firstContour = (uint32_t)contourEnds.size();
+
+        if (ReadGlyphIndexData(_ttfFile, glyphIndex, &glyph) != Result::Success)
+            continue;
+
+        compiled.xmin = glyph.xmin;
+        compiled.ymin = glyph.ymin;
+        compiled.xmax = glyph.xmax;
+        compiled.ymax = glyph.ymax;
+        compiled.contourCount = (uint32_t)glyph.contours.size();
+        for (GlyphContour const& contour : glyph.contours)
+        {
+            pointX.insert(pointX.end(), contour.x.begin(), contour.x.end());
+            pointY.insert(pointY.end(), contour.y.begin(), contour.y.end());
+            contourEnds.push_back((uint32_t)pointX.size());
+        }
+    }
+
+    CompileMetrics(_ttfFile, &glyphs);
+}
+
+Result CompileFont(TrueTypeFile const& _ttfFile, std::vector<uint8_t>* _blob)
+{
+    CompiledFontHeader header{};
+    CompileHeader(_ttfFile, &header);
+
+    std::vector<CompiledCharRange> charRanges{};
+    CompileCharRanges(_ttfFile, &charRanges);
+
+    std::vector<CompiledGlyph> glyphs{};
+    std::vector<uint32_t> contourEnds{};
+    std::vector<int16_t> pointX{};
+    std::vector<int16_t> pointY{};
+    CompileOutlines(_ttfFile, &glyphs, &contourEnds, &pointX, &pointY);
+
+    std::vector<uint8_t>& blob = *_blob;
+    blob.assign(sizeof(CompiledFontHeader), 0u);
+    auto appendSection = [&blob](void const* _data, size_t _size)
+    {
+        uint32_t const offset = (uint32_t)blob.size();
+        uint8_t const* const bytes = (uint8_t const*)_data;
+        blob.insert(blob.end(), bytes, bytes + _size);
+        blob.resize((blob.size() + 3u) & ~(size_t)3u, 0u);
+        return offset;
+    };
+
+    header.charRangeCount = (uint32_t)charRanges.size();
+    header.charRangeOffset = appendSection(charRanges.data(), charRanges.size() * sizeof(CompiledCharRange));
+    header.glyphOffset = appendSection(glyphs.data(), glyphs.size() * sizeof(CompiledGlyph));
+    header.contourEndCount = (uint32_t)contourEnds.size();
+    header.contourEndOffset = appendSection(contourEnds.data(), contourEnds.size() * sizeof(uint32_t));
+    header.pointCount = (uint32_t)pointX.size();
+    header.pointXOffset = appendSection(pointX.data(), pointX.size() * sizeof(int16_t));
+    header.pointYOffset = appendSection(pointY.data(), pointY.size() * sizeof(int16_t));
+
+    header.size = (uint32_t)blob.size();
+    header.payloadHash = HashBytes(blob.data() + sizeof(CompiledFontHeader), blob.size() - sizeof(CompiledFontHeader));
+    std::memcpy(blob.data(), &header, sizeof(CompiledFontHeader));
+    return Result::Success;
+}
+
+Result OpenCompiledFont(void const* _memory, size_t _size, CompiledFont* _font, bool _verifyPayload)
+{
+    *_font = CompiledFont{};
+    if (_size < sizeof(CompiledFontHeader) || ((uintptr_t)_memory & 3u) != 0u)
+        return Result::InvalidCompiledFont;
+
+    uint8_t const* const base = (uint8_t const*)_memory;
+    CompiledFontHeader const* const header = (CompiledFontHeader const*)base;
+    if (header->magic != kCompiledFontMagic)
+        return Result::InvalidCompiledFont;
+    if (header->version != kCompiledFontVersion)
+        return Result::StaleCompiledFont;
+    if (header->size != _size)
+        return Result::InvalidCompiledFont;
+
+    auto sectionFits = [&](uint32_t _offset, uint64_t _count, size_t _elementSize)
+    {
+        return _offset >= sizeof(CompiledFontHeader) && (_offset & 3u) == 0u
+            && (uint64_t)_offset + _count * _elementSize <= (uint64_t)_size;
+    };
+    if (!sectionFits(header->charRangeOffset, header->charRangeCount, sizeof(CompiledCharRange))
+        || !sectionFits(header->glyphOffset, header->glyphCount, sizeof(CompiledGlyph))
+        || !sectionFits(header->contourEndOffset, header->contourEndCount, sizeof(uint32_t))
+        || !sectionFits(header->pointXOffset, header->pointCount, sizeof(int16_t))
+        || !sectionFits(header->pointYOffset, header->pointCount, sizeof(int16_t)))
+        return Result::InvalidCompiledFont;
+
+    if (_verifyPayload
+        && HashBytes(base + sizeof(CompiledFontHeader), _size - sizeof(CompiledFontHeader)) != header->payloadHash)
+        return Result::InvalidCompiledFont;
+
+    _font->header = header;
+    _font->charRanges = (CompiledCharRange const*)(base + header->charRangeOffset);
+    _font->glyphs = (CompiledGlyph const*)(base + header->glyphOffset);
+    _font->contourEnds = (uint32_t const*)(base + header->contourEndOffset);
+    _font->pointX = (int16_t const*)(base + header->pointXOffset);
+    _font->pointY = (int16_t const*)(base + header->pointYOffset);
+    return Result::Success;
+}
+
+bool IsCompiledFrom(CompiledFont const& _font, TrueTypeFile const& _ttfFile)
+{
+    uint32_t checksum = 0u;
+    uint32_t modified[2] = {};
+    ReadSourceStamp(_ttfFile, &checksum, modified);
+    return _font.header->sourceChecksum == checksum
+        && _font.header->sourceModified[0] == modified[0]
+        && _font.header->sourceModified[1] == modified[1]
+        && _font.header->glyphCount == _ttfFile.glyphCount;
+}
+
+uint32_t GetGlyphIndex(CompiledFont const& _font, uint32_t _characterCode)
+{
+    CompiledCharRange const* const first = _font.charRanges;
+    CompiledCharRange const* const last = _font.charRanges + _font.header->charRangeCount;
+    CompiledCharRange const* const range = std::upper_bound(first, last, _characterCode,
+        [](uint32_t _code, CompiledCharRange const& _range) { return _code < _range.firstCode; });
+    if (range == first || (range - 1)->lastCode < _characterCode)
+        return 0u;
+
+    return (uint32_t)((int32_t)_characterCode + (range - 1)->glyphDelta);
+}
+
+GlyphMetrics GetGlyphMetrics(CompiledFont const& _font, uint32_t _glyphIndex)
+{
+    if (_glyphIndex >= _font.header->glyphCount)
+        return GlyphMetrics{};
+
+    CompiledGlyph const& glyph = _font.glyphs[_glyphIndex];
+    return GlyphMetrics{ glyph.advanceWidth, glyph.leftSideBearing };
+}
+
+// Point ranges are checked here rather than on open so that opening stays O(1).
+static bool CompiledContourRange(CompiledFont const& _font, uint32_t _contour, uint32_t* _begin, uint32_t* _end)
+{
+    *_begin = (_contour == 0u) ? 0u : _font.contourEnds[_contour - 1];
+    *_end = _font.contourEnds[_contour];
+    return *_begin < *_end && *_end <= _font.header->pointCount;
+}
+
+Result ReadGlyphIndexData(CompiledFont const& _font, uint32_t _glyphIndex, Glyph* _glyph)
+{
+    TTFTK_COUNT(glyphDecodes, 1);
+
+    if (_glyphIndex >= _font.header->glyphCount)
+        return Result::GlyphMissing;
+
+    CompiledGlyph const& compiled = _font.glyphs[_glyphIndex];
+    if ((uint64_t)compiled.firstContour + compiled.contourCount > _font.header->contourEndCount)
+        return Result::InvalidCompiledFont;
+
+    _glyph->xmin = compiled.xmin;
+    _glyph->ymin = compiled.ymin;
+    _glyph->xmax = compiled.xmax;
+    _glyph->ymax = compiled.ymax;
+    _glyph->contours.resize(compiled.contourCount);
+    for (uint32_t contour = 0u; contour < compiled.contourCount; ++contour)
+    {
+        uint32_t begin = 0u, end = 0u;
+        if (!CompiledContourRange(_font, compiled.firstContour + contour, &begin, &end))
+            return Result::InvalidCompiledFont;
+
+        GlyphContour& output = _glyph->contours[contour];
+        output.x.assign(_font.pointX + begin, _font.pointX + end);
+        output.y.assign(_font.pointY + begin, _font.pointY + end);
+    }
+
+    return Result::Success;
+}
+
+void TransformGlyph(CompiledFont const& _font, uint32_t _glyphIndex, float _scaleX, float _scaleY,
+                    float _offsetX, float _offsetY, GlyphOutline* _outline)
+{
+    GlyphOutline& outline = *_outline;
+    outline.x.clear();
+    outline.y.clear();
+    outline.contourEnds.clear();
+    outline.xmin = outline.xmax = _offsetX;
+    outline.ymin = outline.ymax = _offsetY;
+
+    if (_glyphIndex >= _font.header->glyphCount)
+        return;
+
+    CompiledGlyph const& compiled = _font.glyphs[_glyphIndex];
+    if ((uint64_t)compiled.firstContour + compiled.contourCount > _font.header->contourEndCount)
+        return;
+
+    outline.xmin = (float)compiled.xmin * _scaleX + _offsetX;
+    outline.xmax = (float)compiled.xmax * _scaleX + _offsetX;
+    outline.ymin = (float)compiled.ymin * _scaleY + _offsetY;
+    outline.ymax = (float)compiled.ymax * _scaleY + _offsetY;
+    if (outline.xmin > outline.xmax)
+        std::swap(outline.xmin, outline.xmax);
+    if (outline.ymin > outline.ymax)
+        std::swap(outline.ymin, outline.ymax);
+
+    for (uint32_t contour = 0u; contour < compiled.contourCount; ++contour)
+    {
+        uint32_t begin = 0u, end = 0u;
+        if (!CompiledContourRange(_font, compiled.firstContour + contour, &begin, &end))
+            break;
+
+        for (uint32_t point = begin; point < end; ++point)
+        {
+            outline.x.push_back((float)_font.pointX[point] * _scaleX + _offsetX);
+            outline.y.push_back((float)_font.pointY[point] * _scaleY + _offsetY);
+        }
+        outline.contourEnds.push_back((uint32_t)outline.x.size());
+    }
+}
+
+Result CompileCollection(FontCollection const& _collection, CompiledCollection* _compiled)
+{
+    CompiledCollection compiled{};
+    size_t const faceCount = _collection.faces.size();
+    compiled.headers.resize(faceCount);
+    compiled.faces.resize(faceCount);
+
+    // Per face index of its character ranges, glyph records and points.
+    std::vector<uint32_t> rangeSlots(faceCount), glyphSlots(faceCount), pointSlots(faceCount);
+    std::vector<size_t> rangeOwners{}, glyphOwners{}, pointOwners{};
+
+    auto sameOutlines = [](TrueTypeFile const& _lhs, TrueTypeFile const& _rhs)
+    {
+        return _lhs.required.glyf->offset == _rhs.required.glyf->offset
+            && _lhs.required.loca->offset == _rhs.required.loca->offset
+            && _lhs.indexToLocFormat == _rhs.indexToLocFormat
+            && _lhs.glyphCount == _rhs.glyphCount;
+    };
+    auto sameMetrics = [](TrueTypeFile const& _lhs, TrueTypeFile const& _rhs)
+    {
+        return _lhs.required.hmtx->offset == _rhs.required.hmtx->offset
+            && _lhs.hmetricCount == _rhs.hmetricCount;
+    };
+
+    for (size_t faceIndex = 0u; faceIndex < faceCount; ++faceIndex)
+    {
+        TrueTypeFile const& face = _collection.faces[faceIndex];
+        CompileHeader(face, &compiled.headers[faceIndex]);
+
+        uint32_t slot = 0u;
+        while (slot < rangeOwners.size()
+               && _collection.faces[rangeOwners[slot]].required.cmap->offset != face.required.cmap->offset)
+            ++slot;
+        if (slot == rangeOwners.size())
+        {
+            rangeOwners.push_back(faceIndex);
+            compiled.charRanges.emplace_back();
+            CompileCharRanges(face, &compiled.charRanges.back());
+        }
+        rangeSlots[faceIndex] = slot;
+
+        slot = 0u;
+        while (slot < pointOwners.size() && !sameOutlines(_collection.faces[pointOwners[slot]], face))
+            ++slot;
+        if (slot == pointOwners.size())
+        {
+            pointOwners.push_back(faceIndex);
+            glyphOwners.push_back(faceIndex);
+            compiled.glyphs.emplace_back();
+            compiled.contourEnds.emplace_back();
+            compiled.pointX.emplace_back();
+            compiled.pointY.emplace_back();
+            CompileOutlines(face, &compiled.glyphs.back(), &compiled.contourEnds.back(),
+                            &compiled.pointX.back(), &compiled.pointY.back());
+            pointSlots[faceIndex] = slot;
+            glyphSlots[faceIndex] = (uint32_t)glyphOwners.size() - 1u;
+            continue;
+        }
+        pointSlots[faceIndex] = slot;
+
+        // Same outlines, glyph records only differ by their metrics.
+        uint32_t glyphSlot = 0u;
+        while (glyphSlot < glyphOwners.size()
+               && !(pointSlots[glyphOwners[glyphSlot]] == slot
+                    && sameMetrics(_collection.faces[glyphOwners[glyphSlot]], face)))
+            ++glyphSlot;
+        if (glyphSlot == glyphOwners.size())
+        {
+            glyphOwners.push_back(faceIndex);
+            compiled.glyphs.push_back(compiled.glyphs[glyphSlots[pointOwners[slot]]]);
+            CompileMetrics(face, &compiled.glyphs.back());
+        }
+        glyphSlots[faceIndex] = glyphSlot;
+    }
+
+    for (size_t faceIndex = 0u; faceIndex < faceCount; ++faceIndex)
+    {
+        CompiledFontHeader& header = compiled.headers[faceIndex];
+        std::vector<CompiledCharRange> const& charRanges = compiled.charRanges[rangeSlots[faceIndex]];
+        std::vector<uint32_t> const& contourEnds = compiled.contourEnds[pointSlots[faceIndex]];
+        header.charRangeCount = (uint32_t)charRanges.size();
+        header.contourEndCount = (uint32_t)contourEnds.size();
+        header.pointCount = (uint32_t)compiled.pointX[pointSlots[faceIndex]].size();
+
+        CompiledFont& font = compiled.faces[faceIndex];
+        font.header = &header;
+        font.charRanges = charRanges.data();
+        font.glyphs = compiled.glyphs[glyphSlots[faceIndex]].data();
+        font.contourEnds = contourEnds.data();
+        font.pointX = compiled.pointX[pointSlots[faceIndex]].data();
+        font.pointY = compiled.pointY[pointSlots[faceIndex]].data();
+    }
+
+    std::swap(compiled, *_compiled);
+    return Result::Success;
+}
+
+static constexpr uint32_t TableTag(char const (&_tag)[5])
+{
+    return ((uint32_t)(uint8_t)_tag[0] << 24) | ((uint32_t)(uint8_t)_tag[1] << 16)
+        | ((uint32_t)(uint8_t)_tag[2] << 8) | (uint32_t)(uint8_t)_tag[3];
+}
+
+static inline void WriteU16(std::vector<uint8_t>* _output, uint16_t _value)
+{
+    _output->push_back((uint8_t)(_value >> 8));
+    _output->push_back((uint8_t)_value);
+}
+
+static inline void WriteU32(std::vector<uint8_t>* _output, uint32_t _value)
+{
+    WriteU16(_output, (uint16_t)(_value >> 16));
+    WriteU16(_output, (uint16_t)_value);
+}
+
+static inline void StoreU16(uint8_t* _ptr, uint16_t _value)
+{
+    _ptr[0] = (uint8_t)(_value >> 8);
+    _ptr[1] = (uint8_t)_value;
+}
+
+static inline void StoreU32(uint8_t* _ptr, uint32_t _value)
+{
+    StoreU16(_ptr, (uint16_t)(_value >> 16));
+    StoreU16(_ptr + 2, (uint16_t)_value);
+}
+
+static uint32_t TableChecksum(uint8_t const* _data, size_t _size)
+{
+    uint32_t sum = 0u;
+    for (size_t offset = 0u; offset < _size; offset += 4)
+    {
+        uint32_t word = 0u;
+        for (size_t byte = 0u; byte < 4; ++byte)
+            word = (word << 8) | ((offset + byte < _size) ? _data[offset + byte] : 0u);
+        sum += word;
+    }
+    return sum;
+}
+
+// False when loca points outside of glyf.
+static bool GlyphDataRange(TrueTypeFile const& _ttfFile, uint32_t _glyphIndex, uint32_t* _begin, uint32_t* _end)
+{
+    void const* ptr = _ttfFile.memory + _ttfFile.required.loca->offset
+        + _glyphIndex * ((_ttfFile.indexToLocFormat == 0) ? 2 : 4);
+    if (_ttfFile.indexToLocFormat == 0)
+    {
+        *_begin = ReadU16(ptr) * 2u;
+        *_end = ReadU16(ptr) * 2u;
+    }
+    else
+    {
+        *_begin = ReadU32(ptr);
+        *_end = ReadU32(ptr);
+    }
+    return *_begin <= *_end && *_end <= _ttfFile.required.glyf->length;
+}
 
-                break;
-            }
-        }
-        //std::cout << std::dec << "glyph index " << glyphIndex << std::endl;
+// Offsets of the component glyph indices within a composite glyph, same record walk as
+// ExtractGlyphPoints. Simple glyphs have none.
+static void ListComponentOffsets(uint8_t const* _glyph, uint32_t _size, std::vector<uint32_t>* _offsets)
+{
+    _offsets->clear();
+    if (_size < 10u)
+        return;
+
+    void const* ptr = _glyph;
+    if (ReadS16(ptr) >= 0)
+        return;
+
+    uint32_t offset = 10u;
+    uint16_t flags = 32;
+    while ((flags & 32) && offset + 4u <= _size)
+    {
+        ptr = _glyph + offset;
+        flags = ReadU16(ptr);
+        _offsets->push_back(offset + 2u);
+        offset += 4u + ((flags & 1) ? 4u : 2u);
+        if (flags & 8)
+            offset += 2u;
+        else if (flags & 64)
+            offset += 4u;
+        else if (flags & 128)
+            offset += 8u;
     }
+}
 
-    if (_format == 12)
+// Format 4 segments map runs of consecutive codes to consecutive glyphs through idDelta. The subtable
+// length is 16 bits, segments that do not fit are left to the format 12 subtable.
+static bool WriteCharMapFormat4(std::vector<std::pair<uint32_t, uint32_t>> const& _mapping,
+                                std::vector<uint8_t>* _output)
+{
+    std::vector<uint16_t> startCodes{}, endCodes{}, deltas{};
+    bool complete = true;
+    for (std::pair<uint32_t, uint32_t> const& entry : _mapping)
     {
-        ReadU16(_ptr); // reserved u16
-        uint32_t length = ReadU32(_ptr);
-        uint32_t language = ReadU32(_ptr);
-        uint32_t nGroups = ReadU32(_ptr);
+        if (entry.first >= 0xFFFFu)
+            break;
 
-        //std::cout << std::hex << "looking for " << _charCode << std::endl;
-        for (uint32_t index = 0u; index < nGroups; ++index)
+        uint16_t const delta = (uint16_t)(entry.second - entry.first);
+        if (!startCodes.empty() && endCodes.back() + 1u == entry.first && deltas.back() == delta)
         {
-            uint32_t startCharCode = ReadU32(_ptr);
-            uint32_t endCharCode = ReadU32(_ptr);
-            uint32_t startGlyphCode = ReadU32(_ptr);
-
-            /*
-            std::cout << std::hex
-                      << "start code " << startCharCode << std::endl
-                      << "end code " << endCharCode << std::endl
-                      << "start glyph " << startGlyphCode << std::endl;
-            */
-
-            if (_charCode >= startCharCode && _charCode <= endCharCode)
-            {
-                glyphIndex = startGlyphCode + (_charCode - startCharCode);
-                break;
-            }
+            endCodes.back() = (uint16_t)entry.first;
+            continue;
         }
-        //std::cout << std::dec << "glyph index " << glyphIndex << std::endl;
+        if (16u + (startCodes.size() + 2u) * 8u > 0xFFFFu)
+        {
+            complete = false;
+            break;
+        }
+        startCodes.push_back((uint16_t)entry.first);
+        endCodes.push_back((uint16_t)entry.first);
+        deltas.push_back(delta);
     }
-
-    return glyphIndex;
+    startCodes.push_back(0xFFFFu);
+    endCodes.push_back(0xFFFFu);
+    deltas.push_back(1u);
+
+    uint16_t const segCount = (uint16_t)startCodes.size();
+    uint16_t entrySelector = 0u;
+    while ((2u << entrySelector) <= segCount)
+        ++entrySelector;
+    uint16_t const searchRange = (uint16_t)(2u << entrySelector);
+
+    WriteU16(_output, 4);
+    WriteU16(_output, (uint16_t)(16u + segCount * 8u));
+    WriteU16(_output, 0); // language
+    WriteU16(_output, (uint16_t)(segCount * 2u));
+    WriteU16(_output, searchRange);
+    WriteU16(_output, entrySelector);
+    WriteU16(_output, (uint16_t)(segCount * 2u - searchRange));
+    for (uint16_t endCode : endCodes)
+        WriteU16(_output, endCode);
+    WriteU16(_output, 0); // reservedPad
+    for (uint16_t startCode : startCodes)
+        WriteU16(_output, startCode);
+    for (uint16_t delta : deltas)
+        WriteU16(_output, delta);
+    for (uint16_t segIndex = 0u; segIndex < segCount; ++segIndex)
+        WriteU16(_output, 0); // idRangeOffset
+    return complete;
 }
 
-GlyphPoints ExtractGlyphPoints(uint8_t const* _loca,
-                               uint8_t const* _glyf,
-                               uint16_t _indexToLocFormat,
-                               uint32_t _glyphIndex)
+static void WriteCharMapFormat12(std::vector<std::pair<uint32_t, uint32_t>> const& _mapping,
+                                 std::vector<uint8_t>* _output)
 {
-    GlyphPoints output{};
-
-    uint32_t glyphOffset = 0u;
-    if (_indexToLocFormat == 0)
+    std::vector<uint32_t> groups{};
+    for (std::pair<uint32_t, uint32_t> const& entry : _mapping)
     {
-        void const* ptr = _loca + _glyphIndex * 2;
-        glyphOffset = ReadU16(ptr) * 2;
+        if (!groups.empty()
+            && groups[groups.size() - 2] + 1u == entry.first
+            && groups[groups.size() - 1] + 1u == entry.second)
+        {
+            groups[groups.size() - 2] = entry.first;
+            groups[groups.size() - 1] = entry.second;
+            continue;
+        }
+        groups.insert(groups.end(), { entry.first, entry.first, entry.second });
     }
-    else
+
+    // Groups are stored as (start, end, glyph of end) while merging, the table wants the start glyph.
+    uint32_t const groupCount = (uint32_t)(groups.size() / 3);
+    WriteU16(_output, 12);
+    WriteU16(_output, 0); // reserved
+    WriteU32(_output, 16u + groupCount * 12u);
+    WriteU32(_output, 0); // language
+    WriteU32(_output, groupCount);
+    for (uint32_t group = 0u; group < groupCount; ++group)
     {
-        void const* ptr = _loca + _glyphIndex * 4;
-        glyphOffset = ReadU32(ptr);
+        uint32_t const* const values = &groups[group * 3];
+        WriteU32(_output, values[0]);
+        WriteU32(_output, values[1]);
+        WriteU32(_output, values[2] - (values[1] - values[0]));
     }
+}
 
-    void const* ptr = _glyf + glyphOffset;
-    int16_t numberOfContours = ReadS16(ptr);
-    output.xmin = ReadS16(ptr);
-    output.ymin = ReadS16(ptr);
-    output.xmax = ReadS16(ptr);
-    output.ymax = ReadS16(ptr);
+// Pairs are split over several additive subtables when they overflow the 16 bit subtable length.
+static void WriteSubsetKerning(TrueTypeFile const& _ttfFile, std::vector<uint32_t> const& _oldIndices,
+                               std::vector<uint8_t>* _output)
+{
+    KerningTable kerning{};
+    CompileKerning(_ttfFile, &kerning);
 
-    if (numberOfContours > 0)
+    std::vector<uint32_t> newIndices(_ttfFile.glyphCount, ~0u);
+    for (uint32_t index = 0u; index < _oldIndices.size(); ++index)
+        newIndices[_oldIndices[index]] = index;
+    auto newIndex = [&](uint32_t _oldIndex)
     {
-        output.endPoints.resize(numberOfContours);
-        ptr = ReadU16(ptr, output.endPoints.data(), output.endPoints.size());
-        uint16_t instructionLength = ReadU16(ptr);
-        uint8_t const* instructions = (uint8_t const*)ptr;
-        ptr = AdvancePointer<uint8_t>(ptr, instructionLength);
-        uint8_t const* flagsArray = (uint8_t const*)ptr;
+        return (_oldIndex < newIndices.size()) ? newIndices[_oldIndex] : ~0u;
+    };
 
-        output.pointCount = output.endPoints[output.endPoints.size()-1] + 1;
-        output.contourFlags.resize(output.pointCount);
-        output.contourX.resize(output.pointCount);
-        output.contourY.resize(output.pointCount);
+    // Keyed on the new (left << 16 | right), summed per key below as GetKerning does.
+    std::vector<std::pair<uint32_t, int32_t>> contributions{};
+    for (size_t slot = 0u; slot < kerning.pairKeys.size(); ++slot)
+    {
+        uint32_t const key = kerning.pairKeys[slot];
+        if (key == ~0u || kerning.pairValues[slot] == 0)
+            continue;
+        uint32_t const left = newIndex(key >> 16);
+        uint32_t const right = newIndex(key & 0xFFFFu);
+        if (left != ~0u && right != ~0u)
+            contributions.push_back({ (left << 16) | right, kerning.pairValues[slot] });
+    }
 
-        uint16_t pointIndex = 0u;
-        while (pointIndex < output.pointCount)
+    // Class pairs are only non zero between glyphs listed in both class tables, so only the rows
+    // and columns of kept glyphs are expanded.
+    for (KerningClassMatrix const& matrix : kerning.classMatrices)
+    {
+        std::vector<std::vector<uint32_t>> rowGlyphs(matrix.values.size() / matrix.columnCount);
+        for (uint32_t index = 0u; index < matrix.leftRows.size(); ++index)
         {
-            uint8_t flags = *flagsArray++;
-            if (flags & 8)
-            {
-                uint8_t repeatCount = 1 + *flagsArray++;
-                std::memset(&output.contourFlags[pointIndex], flags, repeatCount);
-                pointIndex += repeatCount;
-            }
-            else
-                output.contourFlags[pointIndex++] = flags;
+            uint32_t const left = newIndex(matrix.firstLeft + index);
+            if (left != ~0u && matrix.leftRows[index] != 0u)
+                rowGlyphs[matrix.leftRows[index]].push_back(left);
+        }
+        std::vector<std::vector<uint32_t>> columnGlyphs(matrix.columnCount);
+        for (uint32_t index = 0u; index < matrix.rightColumns.size(); ++index)
+        {
+            uint32_t const right = newIndex(matrix.firstRight + index);
+            if (right != ~0u && matrix.rightColumns[index] != 0u)
+                columnGlyphs[matrix.rightColumns[index]].push_back(right);
         }
 
-        void const* xArray = (void const*)flagsArray;
-        int16_t x = 0;
-        for (pointIndex = 0u; pointIndex < output.pointCount; ++pointIndex)
+        for (uint32_t row = 1u; row < rowGlyphs.size(); ++row)
         {
-            int16_t dx = 0;
-            if (output.contourFlags[pointIndex] & 2)
+            for (uint32_t column = 1u; column < columnGlyphs.size() && !rowGlyphs[row].empty(); ++column)
             {
-                dx = ReadU8(xArray);
-                if (!(output.contourFlags[pointIndex] & 16))
-                    dx = -dx;
+                int16_t const value = matrix.values[row * matrix.columnCount + column];
+                if (value == 0)
+                    continue;
+                for (uint32_t left : rowGlyphs[row])
+                    for (uint32_t right : columnGlyphs[column])
+                        contributions.push_back({ (left << 16) | right, value });
             }
-            else if (!(output.contourFlags[pointIndex] & 16))
-                    dx = ReadS16(xArray);
-
-            x += dx;
-            output.contourX[pointIndex] = x;
         }
+    }
 
-        void const* yArray = (void const*)xArray;
-        int16_t y = 0;
-        for (pointIndex = 0u; pointIndex < output.pointCount; ++pointIndex)
+    std::sort(contributions.begin(), contributions.end(), [](auto const& _lhs, auto const& _rhs)
+    {
+        return _lhs.first < _rhs.first;
+    });
+    std::vector<uint32_t> pairs{};
+    std::vector<int16_t> values{};
+    for (size_t first = 0u; first < contributions.size();)
+    {
+        int32_t sum = 0;
+        size_t last = first;
+        for (; last < contributions.size() && contributions[last].first == contributions[first].first; ++last)
+            sum += contributions[last].second;
+        if ((int16_t)sum != 0)
         {
-            int16_t dy = 0;
-            if (output.contourFlags[pointIndex] & 4)
-            {
-                dy = ReadU8(yArray);
-                if (!(output.contourFlags[pointIndex] & 32))
-                    dy = -dy;
-            }
-            else if (!(output.contourFlags[pointIndex] & 32))
-                    dy = ReadS16(yArray);
+            pairs.push_back(contributions[first].first);
+            values.push_back((int16_t)sum);
+        }
+        first = last;
+    }
 
-            y += dy;
-            output.contourY[pointIndex] = y;
+    size_t const maxSubtablePairs = 10000u;
+    uint16_t const subtableCount = (uint16_t)((pairs.size() + maxSubtablePairs - 1u) / maxSubtablePairs);
+    WriteU16(_output, 0); // version
+    WriteU16(_output, subtableCount);
+    for (size_t first = 0u; first < pairs.size(); first += maxSubtablePairs)
+    {
+        uint16_t const pairCount = (uint16_t)std::min(pairs.size() - first, maxSubtablePairs);
+        uint16_t entrySelector = 0u;
+        while ((2u << entrySelector) <= pairCount)
+            ++entrySelector;
+        uint16_t const searchRange = (uint16_t)(6u << entrySelector);
+
+        WriteU16(_output, 0); // version
+        WriteU16(_output, (uint16_t)(14u + pairCount * 6u));
+        WriteU16(_output, 0x0001); // horizontal, format 0
+        WriteU16(_output, pairCount);
+        WriteU16(_output, searchRange);
+        WriteU16(_output, entrySelector);
+        WriteU16(_output, (uint16_t)(pairCount * 6u - searchRange));
+        for (size_t pair = first; pair < first + pairCount; ++pair)
+        {
+            WriteU32(_output, pairs[pair]);
+            WriteU16(_output, (uint16_t)values[pair]);
         }
     }
+}
 
-    else if (numberOfContours < 0)
+Result SubsetFont(TrueTypeFile const& _ttfFile, uint32_t const* _charCodes, size_t _count,
+                  std::vector<uint8_t>* _output)
+{
+    uint8_t const* const glyfBase = _ttfFile.memory + _ttfFile.required.glyf->offset;
+
+    // Glyph closure, glyph 0 is always kept.
+    std::vector<uint8_t> keep(_ttfFile.glyphCount, 0u);
+    std::vector<uint32_t> pending{ 0u };
+    std::vector<std::pair<uint32_t, uint32_t>> mapping{};
+    keep[0] = 1u;
+    for (size_t index = 0u; index < _count; ++index)
     {
-        output.pointCount = 0u;
+        uint32_t const glyphIndex = GetGlyphIndex(_ttfFile, _charCodes[index]);
+        if (glyphIndex == 0u || glyphIndex >= _ttfFile.glyphCount)
+            continue;
 
-        //std::cout << "composite glyph" << std::endl;
-        uint16_t flags = 32;
-        while (flags & 32)
+        mapping.push_back({ _charCodes[index], glyphIndex });
+        if (!keep[glyphIndex])
         {
-            float a = 1.f, b = 0.f, c = 0.f, d = 1.f, e = 0.f, f = 0.f;
+            keep[glyphIndex] = 1u;
+            pending.push_back(glyphIndex);
+        }
+    }
 
-            flags = ReadU16(ptr);
-            uint16_t componentIndex = ReadU16(ptr);
-            switch (flags & 3)
-            {
-            case 0:
-            case 1:
-            {
-                //std::cout << "matching points unsupported" << std::endl;
-                return{};
-            } break;
-            case 2:
-            {
-                e = (float)ReadS8(ptr);
-                f = (float)ReadS8(ptr);
-            } break;
-            case 3:
-            {
-                e = (float)ReadS16(ptr);
-                f = (float)ReadS16(ptr);
-            } break;
-            }
+    std::vector<uint32_t> components{};
+    while (!pending.empty())
+    {
+        uint32_t const glyphIndex = pending.back();
+        pending.pop_back();
 
-            if (flags & 8)
-            {
-                a = d = F2Dot14(ReadS16(ptr));
-                b = c = 0.f;
-            }
-            if (flags & 64)
-            {
-                a = F2Dot14(ReadS16(ptr));
-                d = F2Dot14(ReadS16(ptr));
-                b = c = 0.f;
-            }
-            if (flags & 128)
+        uint32_t begin = 0u, end = 0u;
+        if (!GlyphDataRange(_ttfFile, glyphIndex, &begin, &end))
+            return Result::GlyphMissing;
+
+        ListComponentOffsets(glyfBase + begin, end - begin, &components);
+        for (uint32_t offset : components)
+        {
+            void const* ptr = glyfBase + begin + offset;
+            uint16_t const componentIndex = ReadU16(ptr);
+            if (componentIndex < _ttfFile.glyphCount && !keep[componentIndex])
             {
-                a = F2Dot14(ReadS16(ptr));
-                b = F2Dot14(ReadS16(ptr));
-                c = F2Dot14(ReadS16(ptr));
-                d = F2Dot14(ReadS16(ptr));
+                keep[componentIndex] = 1u;
+                pending.push_back(componentIndex);
             }
+        }
+    }
 
-            // These are not the formulas documented on Apple's website,
-            // other sources claim that they are the correct ones.
-            // http://pfaedit.sourceforge.net/Composites/index.html
-            float m = std::sqrt(a*a + b*b);
-            float n = std::sqrt(c*c + d*d);
-
-            bool windingFlip = (a*d - b*c < 0.f);
-
-            GlyphPoints points = ExtractGlyphPoints(_loca, _glyf, _indexToLocFormat, componentIndex);
-            uint16_t beginRange = output.pointCount;
-            output.pointCount += points.pointCount;
-            output.contourFlags.resize(output.pointCount);
-            output.contourX.resize(output.pointCount);
-            output.contourY.resize(output.pointCount);
-            output.endPoints.reserve(output.endPoints.size() + points.endPoints.size());
-            for (uint16_t endPoint : points.endPoints)
-                output.endPoints.push_back(beginRange + endPoint);
-
-            if (!windingFlip)
-            {
-                for (uint16_t pointIndex = 0u; pointIndex < points.pointCount; ++pointIndex)
-                {
-                    output.contourFlags[beginRange + pointIndex] = points.contourFlags[pointIndex];
+    std::vector<uint32_t> newIndices(_ttfFile.glyphCount, 0u);
+    std::vector<uint32_t> oldIndices{};
+    for (uint32_t glyphIndex = 0u; glyphIndex < _ttfFile.glyphCount; ++glyphIndex)
+    {
+        if (!keep[glyphIndex])
+            continue;
+        newIndices[glyphIndex] = (uint32_t)oldIndices.size();
+        oldIndices.push_back(glyphIndex);
+    }
+    uint16_t const glyphCount = (uint16_t)oldIndices.size();
 
-                    int16_t x = points.contourX[pointIndex];
-                    int16_t y = points.contourY[pointIndex];
-                    output.contourX[beginRange + pointIndex] = (int16_t)(m * (a*x + c*y + e));
-                    output.contourY[beginRange + pointIndex] = (int16_t)(n * (b*x + d*y + f));
-                }
-            }
+    for (std::pair<uint32_t, uint32_t>& entry : mapping)
+        entry.second = newIndices[entry.second];
+    std::sort(mapping.begin(), mapping.end());
+    mapping.erase(std::unique(mapping.begin(), mapping.end(), [](auto const& _lhs, auto const& _rhs)
+    {
+        return _lhs.first == _rhs.first;
+    }), mapping.end());
+
+    // glyf with component indices renumbered, glyphs are padded to 4 bytes.
+    std::vector<uint8_t> glyf{};
+    std::vector<uint32_t> glyphOffsets{};
+    glyphOffsets.reserve(glyphCount + 1u);
+    for (uint32_t oldIndex : oldIndices)
+    {
+        glyphOffsets.push_back((uint32_t)glyf.size());
 
-            else
-            {
-                for (uint16_t pointIndex = 0u; pointIndex < points.pointCount; ++pointIndex)
-                {
-                    output.contourFlags[beginRange + pointIndex] =
-                        points.contourFlags[points.pointCount-1 - pointIndex];
+        uint32_t begin = 0u, end = 0u;
+        if (!GlyphDataRange(_ttfFile, oldIndex, &begin, &end))
+            return Result::GlyphMissing;
 
-                    int16_t x = points.contourX[points.pointCount-1 - pointIndex];
-                    int16_t y = points.contourY[points.pointCount-1 - pointIndex];
-                    output.contourX[beginRange + pointIndex] = (int16_t)(m * (a*x + c*y + e));
-                    output.contourY[beginRange + pointIndex] = (int16_t)(n * (b*x + d*y + f));
-                }
-            }
+        size_t const glyphBegin = glyf.size();
+        glyf.insert(glyf.end(), glyfBase + begin, glyfBase + end);
+        ListComponentOffsets(glyfBase + begin, end - begin, &components);
+        for (uint32_t offset : components)
+        {
+            void const* ptr = glyfBase + begin + offset;
+            uint16_t const componentIndex = ReadU16(ptr);
+            if (componentIndex < _ttfFile.glyphCount)
+                StoreU16(&glyf[glyphBegin + offset], (uint16_t)newIndices[componentIndex]);
         }
+        glyf.resize((glyf.size() + 3u) & ~(size_t)3u, 0u);
     }
+    glyphOffsets.push_back((uint32_t)glyf.size());
 
-    return output;
-}
-
-uint16_t IntersectSpline(int16_t const _pointTraceAxis[3], int16_t const _pointCrossAxis[3],
-                         float* _x0, float* _x1)
-{
-    static constexpr uint16_t kLUT = 0x2E74u;
+    int16_t const indexToLocFormat = (glyf.size() < 0x20000u) ? 0 : 1;
+    std::vector<uint8_t> loca{};
+    for (uint32_t offset : glyphOffsets)
+    {
+        if (indexToLocFormat == 0)
+            WriteU16(&loca, (uint16_t)(offset / 2u));
+        else
+            WriteU32(&loca, offset);
+    }
 
-    uint8_t const key = (((_pointCrossAxis[0] > 0) ? 2 : 0)
-                         | ((_pointCrossAxis[1] > 0) ? 4 : 0)
-                         | ((_pointCrossAxis[2] > 0) ? 8 : 0));
+    // Trailing glyphs sharing the last advance only store their lsb.
+    std::vector<GlyphMetrics> metrics(glyphCount);
+    for (uint16_t glyphIndex = 0u; glyphIndex < glyphCount; ++glyphIndex)
+        metrics[glyphIndex] = GetGlyphMetrics(_ttfFile, oldIndices[glyphIndex]);
+    uint16_t hmetricCount = glyphCount;
+    while (hmetricCount > 1u && metrics[hmetricCount - 1].advanceWidth == metrics[hmetricCount - 2].advanceWidth)
+        --hmetricCount;
+    std::vector<uint8_t> hmtx{};
+    uint16_t advanceWidthMax = 0u;
+    for (uint16_t glyphIndex = 0u; glyphIndex < glyphCount; ++glyphIndex)
+    {
+        if (glyphIndex < hmetricCount)
+            WriteU16(&hmtx, metrics[glyphIndex].advanceWidth);
+        WriteU16(&hmtx, (uint16_t)metrics[glyphIndex].leftSideBearing);
+        advanceWidthMax = std::max(advanceWidthMax, metrics[glyphIndex].advanceWidth);
+    }
 
-    uint16_t const intType = kLUT >> key;
-    if (intType & 3)
+    // (3, 1) format 4 and (3, 10) format 12 when codes do not all fit the first.
+    std::vector<uint8_t> cmapFormat4{}, cmapFormat12{};
+    bool const bmpComplete = WriteCharMapFormat4(mapping, &cmapFormat4);
+    if (!bmpComplete || (!mapping.empty() && mapping.back().first >= 0xFFFFu))
+        WriteCharMapFormat12(mapping, &cmapFormat12);
+    std::vector<uint8_t> cmap{};
+    uint16_t const cmapTableCount = cmapFormat12.empty() ? 1u : 2u;
+    WriteU16(&cmap, 0); // version
+    WriteU16(&cmap, cmapTableCount);
+    WriteU16(&cmap, 3);
+    WriteU16(&cmap, 1);
+    WriteU32(&cmap, 4u + cmapTableCount * 8u);
+    if (!cmapFormat12.empty())
+    {
+        WriteU16(&cmap, 3);
+        WriteU16(&cmap, 10);
+        WriteU32(&cmap, (uint32_t)(4u + cmapTableCount * 8u + cmapFormat4.size()));
+    }
+    cmap.insert(cmap.end(), cmapFormat4.begin(), cmapFormat4.end());
+    cmap.insert(cmap.end(), cmapFormat12.begin(), cmapFormat12.end());
+
+    std::vector<std::pair<uint32_t, std::vector<uint8_t>>> tables{};
+    tables.push_back({ TableTag("cmap"), std::move(cmap) });
+    tables.push_back({ TableTag("glyf"), std::move(glyf) });
+    tables.push_back({ TableTag("loca"), std::move(loca) });
+    tables.push_back({ TableTag("hmtx"), std::move(hmtx) });
+    if (_ttfFile.optional.kern)
     {
-        float const a0 = (float)(_pointCrossAxis[0]
-                                 - 2*_pointCrossAxis[1]
-                                 + _pointCrossAxis[2]);
-        float const b0 = (float)(_pointCrossAxis[0]
-                                 - _pointCrossAxis[1]);
-        float const c0 = (float)_pointCrossAxis[0];
+        std::vector<uint8_t> kern{};
+        WriteSubsetKerning(_ttfFile, oldIndices, &kern);
+        if (kern.size() > 4u)
+            tables.push_back({ TableTag("kern"), std::move(kern) });
+    }
 
-        float const a1 = (float)(_pointTraceAxis[0]
-                                 - 2*_pointTraceAxis[1]
-                                 + _pointTraceAxis[2]);
-        float const b1 = (float)(_pointTraceAxis[0]
-                                 - _pointTraceAxis[1]);
-        float const c1 = (float)_pointTraceAxis[0];
+    for (TableDirectoryEntry const& entry : _ttfFile.tableDirectory)
+    {
+        uint8_t const* const source = _ttfFile.memory + entry.offset;
+        std::vector<uint8_t> table(source, source + entry.length);
 
-        if (std::abs(a0) < 0.001f)
+        if (entry.tag == TableTag("head") && table.size() >= 54u)
         {
-            float const t = c0 / (2.f * b0);
-            float const cx = a1*t*t - b1*2.f*t + c1;
-
-            if (intType & 1)
-                *_x0 = cx;
-            if (intType & 2)
-                *_x1 = cx;
+            StoreU32(&table[8], 0u); // checkSumAdjustment, set once the file is complete
+            StoreU16(&table[50], (uint16_t)indexToLocFormat);
         }
-        else
+        else if (entry.tag == TableTag("hhea") && table.size() >= 36u)
         {
-            if (intType & 1)
-            {
-                float const t0 = (b0 - std::sqrt(b0*b0 - a0*c0)) / a0;
-                *_x0 = a1*t0*t0 - b1*2.f*t0 + c1;
-            }
-
-            if (intType & 2)
-            {
-                float const t1 = (b0 + std::sqrt(b0*b0 - a0*c0)) / a0;
-                *_x1 = a1*t1*t1 - b1*2.f*t1 + c1;
-            }
+            StoreU16(&table[10], advanceWidthMax);
+            StoreU16(&table[34], hmetricCount);
+        }
+        else if (entry.tag == TableTag("maxp") && table.size() >= 6u)
+            StoreU16(&table[4], glyphCount);
+        else if (entry.tag == TableTag("post") && table.size() >= 32u)
+        {
+            // Version 3 has no glyph names.
+            table.resize(32u);
+            StoreU32(&table[0], 0x00030000u);
+        }
+        else if (entry.tag == TableTag("OS/2") && table.size() >= 68u)
+        {
+            uint32_t const firstCode = mapping.empty() ? 0u : mapping.front().first;
+            uint32_t const lastCode = mapping.empty() ? 0u : mapping.back().first;
+            StoreU16(&table[64], (uint16_t)std::min<uint32_t>(firstCode, 0xFFFFu));
+            StoreU16(&table[66], (uint16_t)std::min<uint32_t>(lastCode, 0xFFFFu));
         }
+        else if (!(entry.tag == TableTag("name") || entry.tag == TableTag("gasp")
+                   || entry.tag == TableTag("cvt ") || entry.tag == TableTag("fpgm")
+                   || entry.tag == TableTag("prep")))
+            continue;
+
+        tables.push_back({ entry.tag, std::move(table) });
+    }
+    std::sort(tables.begin(), tables.end(), [](auto const& _lhs, auto const& _rhs)
+    {
+        return _lhs.first < _rhs.first;
+    });
+
+    uint16_t const tableCount = (uint16_t)tables.size();
+    uint16_t entrySelector = 0u;
+    while ((2u << entrySelector) <= tableCount)
+        ++entrySelector;
+    uint16_t const searchRange = (uint16_t)(16u << entrySelector);
+
+    std::vector<uint8_t>& output = *_output;
+    output.clear();
+    WriteU32(&output, 0x00010000u);
+    WriteU16(&output, tableCount);
+    WriteU16(&output, searchRange);
+    WriteU16(&output, entrySelector);
+    WriteU16(&output, (uint16_t)(tableCount * 16u - searchRange));
+
+    size_t offset = 12u + tableCount * 16u;
+    size_t headOffset = 0u;
+    for (std::pair<uint32_t, std::vector<uint8_t>> const& table : tables)
+    {
+        if (table.first == TableTag("head"))
+            headOffset = offset;
+        WriteU32(&output, table.first);
+        WriteU32(&output, TableChecksum(table.second.data(), table.second.size()));
+        WriteU32(&output, (uint32_t)offset);
+        WriteU32(&output, (uint32_t)table.second.size());
+        offset += (table.second.size() + 3u) & ~(size_t)3u;
+    }
+    for (std::pair<uint32_t, std::vector<uint8_t>> const& table : tables)
+    {
+        output.insert(output.end(), table.second.begin(), table.second.end());
+        output.resize((output.size() + 3u) & ~(size_t)3u, 0u);
     }
 
-    return intType;
+    if (headOffset != 0u)
+        StoreU32(&output[headOffset + 8], 0xB1B0AFBAu - TableChecksum(output.data(), output.size()));
+    return Result::Success;
 }
 
 #endif